@@ -10,8 +10,10 @@
 #include <l4/liblog/log>
 #include <l4/liblog/loggable-exception>
 
+#include <l4/re/dataspace>
 #include <l4/re/env>
 #include <l4/re/error_helper>
+#include <l4/re/rm>
 
 #include <string>
 
@@ -27,6 +29,94 @@ using L4Re::LibLog::Loggable_exception;
 /* timing data of the worker */
 L4Re::MettEagle::Worker_Metadata metadata;
 
+/**
+ * Dataspaces of the current invocation (see L4Re::Faas::argument_view()),
+ * the manager is asked for them on first use
+ */
+static struct
+{
+  /** set once the manager was asked, reset by every invocation */
+  bool queried = false;
+  bool present = false;
+  l4_size_t arg_size = 0;
+  L4Re::Rm::Unique_region<char *> arg;
+  L4Re::Rm::Unique_region<char *> result;
+  l4_size_t result_size = 0;
+  l4_size_t result_length = 0;
+} payload;
+
+/**
+ * @brief Attach a dataspace the manager mapped for this invocation
+ *
+ * @return  Size of the dataspace
+ */
+static l4_size_t
+attach (char const *name, bool writable,
+        L4Re::Rm::Unique_region<char *> &region)
+{
+  auto ds = L4Re::Env::env ()->get_cap<L4Re::Dataspace> (name);
+  /* the slot is only filled for invocations with dataspaces */
+  if (L4_UNLIKELY (not ds.is_valid () or not ds.validate ().label ()))
+    throw Loggable_exception (-L4_ENOENT, "No '{:s}' dataspace", name);
+  l4_size_t size = ds->size ();
+  auto flags = writable ? L4Re::Rm::F::RW : L4Re::Rm::F::R;
+  auto rights = writable ? L4_CAP_FPAGE_RW : L4_CAP_FPAGE_RO;
+  L4Re::chksys (L4Re::Env::env ()->rm ()->attach (
+                    &region, l4_round_page (size),
+                    L4Re::Rm::F::Search_addr | flags,
+                    L4::Ipc::make_cap (ds, rights)),
+                "attach dataspace");
+  return size;
+}
+
+bool
+L4Re::Faas::has_payload ()
+{
+  if (not payload.queried)
+    {
+      l4_umword_t arg_size = 0;
+      long err = l4_error (getManager ()->payload (&arg_size));
+      if (L4_UNLIKELY (err < 0 and err != -L4_ENOENT))
+        L4Re::chksys (err, "payload rpc");
+      payload.queried = true;
+      payload.present = err == L4_EOK;
+      payload.arg_size = arg_size;
+    }
+  return payload.present;
+}
+
+L4Re::Faas::View
+L4Re::Faas::argument_view ()
+{
+  if (L4_UNLIKELY (not has_payload ()))
+    throw Loggable_exception (-L4_ENOENT, "Invocation without dataspaces");
+  if (not payload.arg.is_valid ())
+    {
+      auto size = attach ("arg", false, payload.arg);
+      if (L4_UNLIKELY (payload.arg_size > size))
+        throw Loggable_exception (-L4_EINVAL, "Argument dataspace too small");
+    }
+  return { payload.arg.get (), payload.arg_size };
+}
+
+L4Re::Faas::View
+L4Re::Faas::result_view ()
+{
+  if (L4_UNLIKELY (not has_payload ()))
+    throw Loggable_exception (-L4_ENOENT, "Invocation without dataspaces");
+  if (not payload.result.is_valid ())
+    payload.result_size = attach ("result", true, payload.result);
+  return { payload.result.get (), payload.result_size };
+}
+
+void
+L4Re::Faas::set_result_length (l4_size_t length)
+{
+  if (L4_UNLIKELY (length > result_view ().size))
+    throw Loggable_exception (-L4_EMSGTOOLONG, "Result dataspace too small");
+  payload.result_length = length;
+}
+
 /**
  * @brief Wrapper main that will handle the manager interaction
  */
@@ -34,23 +124,44 @@ int
 main (int argc, const char *argv[])
 try
   {
-    /* there has to be exactly one argument -- the string passed */
-    if (L4_UNLIKELY (argc != 1))
+    /* there has to be at most one argument -- the string passed */
+    if (L4_UNLIKELY (argc > 1))
       throw Loggable_exception (
           -L4_EINVAL, "Wrong number of arguments. Expected 1 got {:d}", argc);
 
-    /* actual call to the faas function */
-    metadata.start_function = std::chrono::high_resolution_clock::now ();
-    metadata.start_runtime = metadata.start_function;
-    std::string ret{ Main (argv[0]) };
-    metadata.end_function = std::chrono::high_resolution_clock::now ();
-    metadata.end_runtime = metadata.end_function;
+    std::string arg;
+    if (argc == 1)
+      arg = argv[0];
+    else
+      {
+        /* started as zygote -- wait for the first invocation */
+        L4Re::chksys (L4Re::Faas::getManager ()->ready (), "ready rpc");
+        arg = L4Re::Faas::argument ();
+      }
+    while (true)
+      {
+        /* actual call to the faas function */
+        metadata.start_function = std::chrono::high_resolution_clock::now ();
+        metadata.start_runtime = metadata.start_function;
+        payload.queried = false;
+        payload.result_length = 0;
+        std::string ret{ Main (arg) };
+        metadata.end_function = std::chrono::high_resolution_clock::now ();
+        metadata.end_runtime = metadata.end_function;
 
-    /* the default _exit implementation can only return an integer *
-     * to pass a string the custom manager->exit must be used.     */
-    L4Re::chksys (L4Re::Faas::getManager ()->exit (ret.c_str (), metadata), "exit rpc");
+        /* the manager revokes the dataspaces after the invocation */
+        payload.arg.reset ();
+        payload.result.reset ();
+        metadata.result_length = payload.result_length;
 
-    throw Loggable_exception(-L4_EFAULT, "wrapper unreachable");
+        /* the default _exit implementation can only return an integer *
+         * to pass a string the custom manager rpc must be used. The   *
+         * call returns once the manager reuses this worker.           */
+        L4Re::chksys (L4Re::Faas::getManager ()->next_invocation (
+                          ret.c_str (), metadata),
+                      "next invocation rpc");
+        arg = L4Re::Faas::argument ();
+      }
   }
 /**
  * These catch blocks will catch errors that are thrown by utility
@@ -8,18 +8,22 @@
 #include "py-faas-lib.h"
 
 #include <l4/python/Python.h>
+#include <l4/python/marshal.h>
 
 #include <l4/libfaas/faas>
 #include <l4/liblog/log>
 #include <l4/liblog/loggable-exception>
 
 #include <l4/mett-eagle/worker>
+#include <l4/re/dataspace>
 #include <l4/re/env>
 #include <l4/re/error_helper>
+#include <l4/re/rm>
 
 #include <string>
 
 #include <cstdio>
+#include <cstring>
 #include <l4/sys/utcb.h>
 
 #include <l4/fmt/core.h>
@@ -30,28 +34,121 @@ using L4Re::LibLog::Loggable_exception;
 /* timing data of the worker */
 L4Re::MettEagle::Worker_Metadata metadata;
 
-static const char *
-invoke_python_main (const char *filename, std::string arg)
+/**
+ * @brief Compile the script into a marshalled code object
+ *
+ * The code object is written to the 'compile' dataspace, prefixed by its
+ * length (l4_uint32_t). Workers receive this dataspace as 'code' and will
+ * load the code object instead of compiling the script again.
+ */
+static void
+compile_python (const char *filename, L4::Cap<L4Re::Dataspace> output)
 {
   Py_NoSiteFlag = 1; /* do not try to import 'site' */
   Py_Initialize ();
-  /* make the faas library available inside python  */
-  Py_InitModule ("faas", faas_methods);
 
   auto file = fopen (filename, "r");
+  if (L4_UNLIKELY (file == NULL))
+    throw Loggable_exception (-L4_ENOENT, "Could not open '{:s}'", filename);
+  std::string source;
+  char buffer[1024];
+  for (size_t read; (read = fread (buffer, 1, sizeof (buffer), file)) > 0;)
+    source.append (buffer, read);
+  fclose (file);
+
+  auto pCode = Py_CompileString (source.c_str (), filename, Py_file_input);
+  if (L4_UNLIKELY (pCode == NULL))
+    {
+      PyErr_Print ();
+      throw Loggable_exception (-L4_EINVAL, "Could not compile the script");
+    }
+  auto pMarshalled = PyMarshal_WriteObjectToString (pCode, Py_MARSHAL_VERSION);
+  Py_DECREF (pCode);
+  if (L4_UNLIKELY (pMarshalled == NULL))
+    throw Loggable_exception (-L4_EINVAL, "Could not marshal the code object");
+
+  l4_uint32_t length = PyString_Size (pMarshalled);
+  if (L4_UNLIKELY (sizeof (length) + length > output->size ()))
+    throw Loggable_exception (-L4_ENOMEM, "Code object too large");
+
+  L4Re::Rm::Unique_region<char *> region;
+  L4Re::chksys (L4Re::Env::env ()->rm ()->attach (
+                    &region, output->size (),
+                    L4Re::Rm::F::Search_addr | L4Re::Rm::F::RW,
+                    L4::Ipc::make_cap_rw (output)),
+                "attach code dataspace");
+  memcpy (region.get (), &length, sizeof (length));
+  memcpy (region.get () + sizeof (length), PyString_AsString (pMarshalled),
+          length);
+  Py_DECREF (pMarshalled);
+}
+
+/**
+ * @brief Execute a code object created by compile_python()
+ */
+static void
+run_python_code (L4::Cap<L4Re::Dataspace> code, PyObject *pModule)
+{
+  L4Re::Rm::Unique_region<char const *> region;
+  L4Re::chksys (L4Re::Env::env ()->rm ()->attach (
+                    &region, code->size (),
+                    L4Re::Rm::F::Search_addr | L4Re::Rm::F::R,
+                    L4::Ipc::make_cap (code, L4_CAP_FPAGE_RO)),
+                "attach code dataspace");
+
+  l4_uint32_t length;
+  memcpy (&length, region.get (), sizeof (length));
+  if (L4_UNLIKELY (sizeof (length) + length > code->size ()))
+    throw Loggable_exception (-L4_EINVAL, "Invalid code dataspace");
+
+  auto pCode = PyMarshal_ReadObjectFromString (
+      const_cast<char *> (region.get ()) + sizeof (length), length);
+  if (L4_UNLIKELY (pCode == NULL or not PyCode_Check (pCode)))
+    throw Loggable_exception (-L4_EINVAL, "Could not load the code object");
+
+  /* executes the script within the namespace of the '__main__' module */
+  auto pGlobals = PyModule_GetDict (pModule);
+  auto pResult = PyEval_EvalCode ((PyCodeObject *)pCode, pGlobals, pGlobals);
+  if (pResult == NULL)
+    PyErr_Print ();
+  Py_XDECREF (pResult);
+  Py_DECREF (pCode);
+}
+
+/**
+ * @brief Initialize the interpreter and execute the script
+ *
+ * This has to be done only once per worker, the state of the interpreter is
+ * kept for all invocations handled by this worker.
+ *
+ * @return  The 'main' method of the script (new reference)
+ */
+static PyObject *
+init_python (const char *filename)
+{
+  Py_NoSiteFlag = 1; /* do not try to import 'site' */
+  Py_Initialize ();
+  /* make the faas library available inside python  */
+  Py_InitModule ("faas", faas_methods);
 
+  /* borrowed reference */
   auto pModule = PyImport_AddModule ("__main__");
 
+  if (L4_UNLIKELY (pModule == NULL))
+    throw Loggable_exception (-L4_EINVAL,
+                              "Could not create '__main__' module");
+
   /* this interprets the whole script -- all methods are defined, global
    * variables are created and global code is executes (main method is not
    * executed at this point!) */
   // todo maybe this should also be measured as 'function time' rather than
   // adding to the runtime setup?
-  PyRun_SimpleFileEx (file, filename, true);
-
-  if (L4_UNLIKELY (pModule == NULL))
-    throw Loggable_exception (-L4_EINVAL,
-                              "Could not create '__main__' module");
+  auto code = L4Re::Env::env ()->get_cap<L4Re::Dataspace> ("code");
+  if (code.is_valid ())
+    /* the manager already compiled the script */
+    run_python_code (code, pModule);
+  else
+    PyRun_SimpleFileEx (fopen (filename, "r"), filename, true);
 
   /* get the main method from the script */
   auto pFunc = PyObject_GetAttrString (pModule, "main");
@@ -61,6 +158,15 @@ invoke_python_main (const char *filename, std::string arg)
   if (L4_UNLIKELY (not PyCallable_Check (pFunc)))
     throw Loggable_exception (-L4_EINVAL, "'main' is not callable");
 
+  return pFunc;
+}
+
+/**
+ * @brief Call the main method of the script with a single argument
+ */
+static std::string
+invoke_python_main (PyObject *pFunc, std::string arg)
+{
   /* arguments are a tuple -- only 1 string will be passed */
   auto pArgs = PyTuple_New (1);
   auto pValue = PyString_FromString (arg.c_str ());
@@ -76,17 +182,15 @@ invoke_python_main (const char *filename, std::string arg)
 
   Py_DECREF (pArgs); /* arguments are no longer needed */
 
-  /* if function returned nothing use an empty string */
-  const char *ret;
-  if (pValue == NULL)
-    ret = "";
-  else
-    ret = PyString_AsString (pValue);
+  /* if function returned nothing use an empty string -- the string has to be
+   * copied before the value is released */
+  std::string ret;
+  if (pValue != NULL)
+    if (auto string = PyString_AsString (pValue))
+      ret = string;
 
-  /* values no longer needed */
+  /* value no longer needed */
   Py_XDECREF (pValue); /* XDECREF -> value may be NULL */
-  Py_DECREF (pFunc);
-  Py_DECREF (pModule);
   // Py_Finalize (); todo fix 'No signal handler found' error
 
   return ret;
@@ -99,10 +203,10 @@ int
 main (int argc, const char *argv[])
 try
   {
-    (void)argv;
+    metadata.start_runtime = std::chrono::high_resolution_clock::now ();
 
-    /* there has to be exactly one argument -- the string passed */
-    if (L4_UNLIKELY (argc != 1))
+    /* there has to be at most one argument -- the string passed */
+    if (L4_UNLIKELY (argc > 1))
       throw Loggable_exception (
           -L4_EINVAL, "Wrong number of arguments. Expected 1 got {:d}", argc);
 
@@ -111,19 +215,48 @@ try
     L4Re::chkcap (L4Re::Env::env ()->get_cap<L4Re::Dataspace> ("function"),
                   "no capability called 'function' passed");
 
-    metadata.start_runtime = std::chrono::high_resolution_clock::now ();
+    /* the manager compiles the script once while creating the action */
+    auto output = L4Re::Env::env ()->get_cap<L4Re::Dataspace> ("compile");
+    if (output.is_valid ())
+      {
+        compile_python ("function", output);
+        L4Re::chksys (L4Re::Faas::getManager ()->exit ("", metadata),
+                      "exit rpc");
+        __builtin_unreachable ();
+      }
+
+    /* the interpreter is set up once and used for all invocations */
+    auto pFunc = init_python ("function");
+
+    std::string arg;
+    if (argc == 1)
+      arg = argv[0];
+    else
+      {
+        /* started as zygote -- wait for the first invocation */
+        L4Re::chksys (L4Re::Faas::getManager ()->ready (), "ready rpc");
+        metadata.start_runtime = std::chrono::high_resolution_clock::now ();
+        arg = L4Re::Faas::argument ();
+      }
 
-    /* actual call to the faas function */
-    auto answer = invoke_python_main ("function", argv[0]);
+    while (true)
+      {
+        /* actual call to the faas function */
+        auto answer = invoke_python_main (pFunc, arg);
 
-    metadata.end_runtime = std::chrono::high_resolution_clock::now ();
+        metadata.end_runtime = std::chrono::high_resolution_clock::now ();
 
-    /* the default _exit implementation can only return an integer *
-     * to pass a string the custom manager->exit must be used.     */
-    L4Re::chksys (L4Re::Faas::getManager ()->exit (answer, metadata),
-                  "exit rpc");
+        /* the default _exit implementation can only return an integer *
+         * to pass a string the custom manager rpc must be used. The   *
+         * call returns once the manager reuses this worker.           */
+        L4Re::chksys (L4Re::Faas::getManager ()->next_invocation (
+                          answer.c_str (), metadata),
+                      "next invocation rpc");
 
-    __builtin_unreachable ();
+        /* the runtime is already set up for this invocation */
+        metadata.start_runtime = std::chrono::high_resolution_clock::now ();
+        arg = L4Re::Faas::argument ();
+      }
   }
 /**
  * These catch blocks will catch errors that are thrown by utility
@@ -17,6 +17,8 @@
 
 #include <l4/liblog/log>
 
+#include <algorithm>
+
 /**
  * @brief Allocate a Dataspace
  *
@@ -69,10 +71,18 @@ App_model::prog_reserve_area (l4_addr_t *start, unsigned long size,
   return _rm->reserve_area (start, size, flags, align);
 }
 
+/**
+ * @brief Copy the initialized part of a writable segment
+ *
+ * Segments that only consist of zero initialized data (e.g. .bss) have no
+ * initialized part, the freshly allocated dataspace is already zeroed.
+ */
 void
 App_model::copy_ds (Dataspace dst, unsigned long dst_offs, Const_dataspace src,
                     unsigned long src_offs, unsigned long size)
 {
+  if (size == 0)
+    return;
   L4Re::chksys (dst->copy_in (dst_offs, src.get (), src_offs, size),
                 "copy failed");
 }
@@ -81,6 +91,20 @@ l4_addr_t
 App_model::local_attach_ds (Const_dataspace ds, unsigned long size,
                             unsigned long offset) const
 {
+  /* the binary was already attached while creating the action */
+  if (_image)
+    if (auto data = _image->data (ds.get (), offset, size))
+      return l4_addr_t (data);
+  /* same for the dynamic loader */
+  if (auto image = library_cache.image (ds.get ()))
+    if (auto data = image->data (ds.get (), offset, size))
+      {
+        if (std::find (_libraries.begin (), _libraries.end (), image)
+            == _libraries.end ())
+          _libraries.push_back (image);
+        return l4_addr_t (data);
+      }
+
   auto rm = L4Re::Env::env ()->rm ();
   l4_addr_t pg_offset = l4_trunc_page (offset);
   l4_addr_t in_pg_offset = offset - pg_offset;
@@ -96,6 +120,13 @@ App_model::local_attach_ds (Const_dataspace ds, unsigned long size,
 void
 App_model::local_detach_ds (l4_addr_t addr, unsigned long /*size*/) const
 {
+  /* stays attached as long as the image exists */
+  if (_image and _image->contains (addr))
+    return;
+  for (auto const &image : _libraries)
+    if (image->contains (addr))
+      return;
+
   auto rm = L4Re::Env::env ()->rm ();
   l4_addr_t pg_addr = l4_trunc_page (addr);
   chksys (rm->detach (pg_addr, 0), "detach temporary VMA");
@@ -103,15 +134,20 @@ App_model::local_detach_ds (l4_addr_t addr, unsigned long /*size*/) const
 
 App_model::App_model (L4::Cap<MettEagle::Manager_Worker> const &parent,
                       L4::Cap<L4::Scheduler> const &scheduler,
-                      L4::Cap<L4::Factory> const &alloc)
-    : _task (chkcap (L4Re::Util::make_unique_del_cap<L4::Task> (),
-                           "allocating task cap")),
-      _thread (chkcap (L4Re::Util::make_unique_del_cap<L4::Thread> (),
-                             "allocating thread cap")),
-      _rm (chkcap (L4Re::Util::make_unique_cap<L4Re::Rm> (),
-                         "allocating region-map cap"))
+                      L4::Cap<L4::Factory> const &alloc,
+                      std::shared_ptr<Kobject_pool> kobjects)
+    : _task (kobjects), _thread (kobjects)
 {
-  chksys (alloc->create (_rm.get ()), "allocating new region map");
+  /* the region maps of the pool were created by the user factory, they can
+   * only be used by workers without memory limit */
+  if (kobjects and alloc == L4Re::Env::env ()->user_factory ())
+    _rm = kobjects->take_rm ();
+  if (not _rm.is_valid ())
+    {
+      _rm = chkcap (L4Re::Util::make_unique_cap<L4Re::Rm> (),
+                    "allocating region-map cap");
+      chksys (alloc->create (_rm.get ()), "allocating new region map");
+    }
 
   // set default values for utcb area, values may be changed by loader
   prog_info ()->utcbs_start = Utcb_area_start;
@@ -130,7 +166,7 @@ App_model::App_model (L4::Cap<MettEagle::Manager_Worker> const &parent,
   prog_info ()->log       = L4Re::Env::env ()->log ().fpage ();
   prog_info ()->factory   = L4Re::Env::env ()->factory ().fpage (); // pass own kernel factory
   prog_info ()->scheduler = scheduler.fpage ();
-  prog_info ()->ldr_flags = 0; // TODO improve performance with COW??
+  prog_info ()->ldr_flags = 0; // no COW -- see all_segs_cow ()
   prog_info ()->l4re_dbg  = 0;
   // clang-format on
 }
@@ -141,6 +177,14 @@ App_model::App_model (L4::Cap<MettEagle::Manager_Worker> const &parent,
 App_model::Dataspace
 App_model::alloc_app_stack ()
 {
+  if (_stack_pool)
+    {
+      auto entry = _stack_pool->take (_stack.stack_size ());
+      _stack.set_stack (entry->ds, entry->region.get (), entry->size);
+      _stack_lease = Stack_pool::Lease (_stack_pool, entry);
+      return entry->ds;
+    }
+
   // create a new kernel-object for the Dataspace of the stack
   auto stack = chkcap (L4Re::Util::make_shared_cap<L4Re::Dataspace> (),
                        "allocate stack capability");
@@ -13,7 +13,11 @@
 
 #include <l4/re/l4aux.h>
 
+#include "elf_image.h"
+#include "kobject_pool.h"
+#include "library_cache.h"
 #include "stack.h"
+#include "stack_pool.h"
 #include <l4/libloader/elf>
 #include <l4/libloader/loader>
 #include <l4/libloader/remote_app_model>
@@ -26,6 +30,8 @@
 #include <l4/liblog/loggable-exception>
 #include <l4/mett-eagle/worker>
 
+#include <vector>
+
 /**
  * @brief This class will provide all functions that are needed but not
  * implemented by Base_app_model/Loader and Remote_app_model
@@ -50,14 +56,72 @@ struct App_model : public Ldr::Base_app_model<Stack>
   typedef L4Re::Util::Shared_cap<L4Re::Dataspace> Const_dataspace;
   typedef Stack_base::Dataspace Dataspace;
 
-  L4Re::Util::Unique_del_cap<L4::Task> _task;
-  L4Re::Util::Unique_del_cap<L4::Thread>
-      _thread; // TODO faster without 'del', but is it safe?
+  /**
+   * Stacks of the pool can only be recycled once the task is gone, thus the
+   * lease must be declared (and constructed) before the task
+   */
+  Stack_pool::Lease _stack_lease;
+
+  Kobject_pool::Cap<L4::Task> _task;
+  Kobject_pool::Cap<L4::Thread> _thread;
   L4Re::Util::Unique_cap<L4Re::Rm> _rm;
 
+  /**
+   * Already attached version of the binary, used to serve
+   * ::local_attach_ds() without attaching the binary again
+   */
+  std::shared_ptr<Elf_image const> _image;
+
+  /**
+   * Images of the Library_cache the loader reads from, they are kept until
+   * the process is destroyed, even if the cache replaced them
+   */
+  mutable std::vector<std::shared_ptr<Elf_image const> > _libraries;
+
+  /**
+   * Pool the stack is taken from, if set
+   *
+   * Note: The stack of the pool is not allocated by the memory allocator of
+   * the process
+   */
+  std::shared_ptr<Stack_pool> _stack_pool;
+
+  /**
+   * If set, ::run_thread() only records the thread. The process is loaded
+   * but it will not run until ::start_thread() is called.
+   */
+  bool _defer_start = false;
+
+  /**
+   * Selects the cpu of the scheduler the thread will run on, the workers of
+   * a client are distributed among its cpus (see Worker_Pool::create())
+   */
+  unsigned _placement = 0;
+
+  /**
+   * Cpus the thread may run on (see Cpu_allocator::affinity()), the cpus of
+   * the scheduler are used if the map is empty
+   */
+  l4_sched_cpu_set_t _affinity = l4_sched_cpu_set (0, 0, 0);
+
+  /**
+   * Scheduler that runs the thread instead of the one of the process, if set
+   * (see Options::steal)
+   */
+  L4Re::Util::Shared_cap<L4::Scheduler> _run_scheduler;
+
+  /** thread and scheduling parameters recorded by ::run_thread() */
+  L4::Cap<L4::Thread> _deferred_thread;
+  l4_sched_param_t _deferred_param;
+
+  /**
+   * @param kobjects  Pool the kernel objects are taken from (might be
+   *                  nullptr)
+   */
   explicit App_model (L4::Cap<MettEagle::Manager_Worker> const &parent,
                       L4::Cap<L4::Scheduler> const &scheduler,
-                      L4::Cap<L4::Factory> const &alloc);
+                      L4::Cap<L4::Factory> const &alloc,
+                      std::shared_ptr<Kobject_pool> kobjects);
 
   Dataspace alloc_ds (unsigned long size) const;
 
@@ -65,9 +129,8 @@ struct App_model : public Ldr::Base_app_model<Stack>
   static Const_dataspace
   open_file (char const *file)
   {
-    return L4Re::Util::Shared_cap<L4Re::Dataspace> (
-        chkcap (L4Re::Util::Env_ns{}.query<L4Re::Dataspace> (file),
-                "failed to open file"));
+    /* the files are only resolved and parsed once, see Library_cache */
+    return library_cache.open (file).ds;
   }
 
   /* needed by Remote_app_model */
@@ -85,6 +148,14 @@ struct App_model : public Ldr::Base_app_model<Stack>
                        Const_dataspace src, unsigned long src_offs,
                        unsigned long size);
 
+  /**
+   * Read-only segments are attached directly from the binary dataspace and
+   * thereby shared by all workers of an action. Only writable segments are
+   * copied (see ::copy_ds()).
+   *
+   * Note: moe does not provide copy-on-write dataspaces, thus the writable
+   * segments can't share their pages until the first write.
+   */
   bool
   all_segs_cow ()
   {
@@ -137,26 +208,66 @@ struct App_model : public Ldr::Base_app_model<Stack>
   void get_task_caps (L4::Cap<L4::Factory> *factory, L4::Cap<L4::Task> *task,
                       L4::Cap<L4::Thread> *thread);
 
+  /**
+   * @brief Scheduler that is used to run the thread of the process
+   */
+  L4::Cap<L4::Scheduler>
+  run_scheduler () const
+  {
+    if (_run_scheduler.is_valid ())
+      return _run_scheduler.get ();
+    return L4::Cap<L4::Scheduler> (prog_info ()->scheduler.raw
+                                   & (~0UL << L4_FPAGE_ADDR_SHIFT));
+  }
+
   l4_msgtag_t
   run_thread (L4::Cap<L4::Thread> thread, l4_sched_param_t const &)
   {
-    auto scheduler = L4::Cap<L4::Scheduler> (prog_info ()->scheduler.raw
-                                             & (~0UL << L4_FPAGE_ADDR_SHIFT));
+    auto scheduler = run_scheduler ();
 
-    l4_umword_t cpu_max;
-    l4_sched_cpu_set_t cpus = l4_sched_cpu_set (0, 0);
-    l4_msgtag_t t = scheduler->info (&cpu_max, &cpus);
-    if (L4_UNLIKELY (l4_error (t)))
-      return t;
+    /* the scheduler of cpus beyond the first word isn't limited to them */
+    l4_sched_cpu_set_t cpus = _affinity;
+    if (not cpus.map)
+      {
+        l4_umword_t cpu_max;
+        cpus = l4_sched_cpu_set (0, 0);
+        l4_msgtag_t t = scheduler->info (&cpu_max, &cpus);
+        if (L4_UNLIKELY (l4_error (t)))
+          return t;
+      }
 
     l4_sched_param_t sp = l4_sched_param (L4_SCHED_MIN_PRIO);
     sp.affinity = cpus;
 
-    using namespace L4Re::LibLog;
+    /* keep only the selected bit (round robin over the available cpus) */
+    if (auto count = __builtin_popcountl (cpus.map))
+      {
+        for (auto n = _placement % count; n; n--)
+          sp.affinity.map &= sp.affinity.map - 1; /* clear the lowest bit */
+        sp.affinity.map &= ~(sp.affinity.map - 1); /* keep the lowest bit */
+      }
+
+    if (_defer_start)
+      {
+        _deferred_thread = thread;
+        _deferred_param = sp;
+        return l4_msgtag (L4_EOK, 0, 0, 0);
+      }
 
     return scheduler->run_thread (thread, sp);
   }
 
+  /**
+   * @brief Start the thread of a process that was loaded with
+   * ::_defer_start set
+   */
+  l4_msgtag_t
+  start_thread ()
+  {
+    _defer_start = false;
+    return run_scheduler ()->run_thread (_deferred_thread, _deferred_param);
+  }
+
   virtual void push_argv_strings () = 0;
   virtual void push_env_strings () = 0;
 
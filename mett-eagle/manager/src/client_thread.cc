@@ -0,0 +1,254 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "client_thread.h"
+
+#include <l4/liblog/exc_log_dispatch>
+
+#include <l4/re/env>
+#include <l4/re/util/object_registry>
+#include <l4/sys/irq>
+
+#include <pthread-l4.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+Client_thread_pool client_threads;
+
+Client_thread *
+Client_thread::create ()
+{
+  pthread_attr_t attr;
+  pthread_attr_init (&attr);
+  /*
+   * This will prevent pthreads from directly starting the new thread and is
+   * necessary to make sure that the server loop was created before the
+   * thread uses it.
+   */
+  attr.create_flags |= PTHREAD_L4_ATTR_NO_START;
+
+  auto thread = new Client_thread ();
+  int failed = pthread_create (
+      &thread->_pthread, &attr,
+      [] (void *arg) -> void * {
+        auto thread = static_cast<Client_thread *> (arg);
+        bool destroyed;
+        {
+          std::lock_guard<std::mutex> guard (thread->_lock);
+          thread->_started = true;
+          destroyed = thread->_destroyed;
+        }
+        if (destroyed)
+          thread->exit ();
+
+        // log<INFO> ("Start client ipc server");
+
+        /* the loop is only left with pthread_exit, see handle_irq() */
+        thread->_server->internal_loop (
+            Exc_log_dispatch<L4Re::Util::Object_registry &> (
+                *thread->_server->registry ()),
+            l4_utcb ());
+        return nullptr;
+      },
+      thread);
+  pthread_attr_destroy (&attr);
+  if (L4_UNLIKELY (failed))
+    {
+      delete thread;
+      throw Loggable_exception (-L4_ENOMEM, "Failed to create client thread");
+    }
+
+  thread->_thread = L4::Cap<L4::Thread> (pthread_l4_cap (thread->_pthread));
+  // l4_debugger_set_object_name (thread->_thread.cap (), "mngr clnt");
+  thread->_server = std::make_unique<Client_server> (
+      thread->_thread, L4Re::Env::env ()->factory ());
+
+  /* the irq stays registered while the thread is parked */
+  chkcap (thread->_server->registry ()->register_irq_obj (thread),
+          "gate deletion irq");
+  chksys (thread->_thread->register_del_irq (thread->obj_cap ()),
+          "register gate deletion irq");
+
+  /* separate thread from the 'client_handler' object */
+  pthread_detach (thread->_pthread);
+  return thread;
+}
+
+void
+Client_thread::bind (L4::Cap<L4::Ipc_gate> client_gate,
+                     std::function<void (void)> cleanup)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  _client_gate = client_gate;
+  _cleanup = cleanup;
+}
+
+void
+Client_thread::destroy ()
+{
+  bool started;
+  {
+    std::lock_guard<std::mutex> guard (_lock);
+    _destroyed = true;
+    started = _started;
+  }
+  if (started)
+    chksys (L4::cap_cast<L4::Irq> (obj_cap ())->trigger (),
+            "trigger client thread irq");
+  else
+    chksys (L4Re::Env::env ()->scheduler ()->run_thread (
+                _thread, l4_sched_param (L4RE_MAIN_THREAD_PRIO)),
+            "start client thread");
+}
+
+void
+Client_thread::handle_irq ()
+{
+  std::function<void (void)> cleanup;
+  bool destroyed;
+  {
+    std::lock_guard<std::mutex> guard (_lock);
+    destroyed = _destroyed;
+  }
+  if (destroyed)
+    exit ();
+
+  {
+    std::lock_guard<std::mutex> guard (_lock);
+    /* check if the deleted gate is the one of the client, and not one of a
+     * worker process */
+    if (not _client_gate.is_valid () or _client_gate.validate ().label ())
+      return;
+
+    cleanup = std::move (_cleanup);
+    _cleanup = nullptr;
+    _client_gate = L4::Cap<L4::Ipc_gate>::Invalid;
+  }
+
+  // log<DEBUG> ("client left");
+
+  cleanup ();
+
+  /* the thread might be bound to the next client right away, thus nothing
+   * must be touched afterwards */
+  if (client_threads.park (this))
+    return;
+
+  exit ();
+}
+
+void
+Client_thread::exit ()
+{
+  // log<DEBUG> ("deleting client thread");
+
+  /* the irq is bound to the thread and would keep its kernel object alive,
+   * the pthread library deletes the thread once it exited */
+  _server->registry ()->unregister_obj (this);
+  delete this;
+
+  /* the handler will be called by the thread that should be deleted  *
+   * thus it's possible to use pthread_exit instead of pthread_cancel */
+  pthread_exit (nullptr);
+
+  throw Loggable_exception (-L4_EFAULT, "Pthread exit failed");
+}
+
+Client_thread *
+Client_thread_pool::take ()
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  if (_parked.empty ())
+    return nullptr;
+
+  auto thread = _parked.front ();
+  _parked.pop_front ();
+  _taken.notify_one ();
+  return thread;
+}
+
+bool
+Client_thread_pool::park (Client_thread *thread)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  if (_parked.size () + _spawning >= options.thread_pool)
+    return false;
+
+  _parked.push_back (thread);
+  return true;
+}
+
+void
+Client_thread_pool::spawn_loop ()
+{
+  /* delay after a failed creation, doubled on every further failure */
+  std::chrono::milliseconds backoff{ 0 };
+  while (true)
+    {
+      {
+        std::unique_lock<std::mutex> guard (_lock);
+        _taken.wait (guard, [this] {
+          return _parked.size () + _spawning < options.thread_pool;
+        });
+        _spawning++;
+      }
+
+      Client_thread *thread = nullptr;
+      try
+        {
+          thread = Client_thread::create ();
+        }
+      catch (Loggable_exception &e)
+        {
+          log<ERROR> (e);
+        }
+      catch (L4::Runtime_error &e)
+        {
+          log<ERROR> (e);
+        }
+
+      {
+        std::lock_guard<std::mutex> guard (_lock);
+        _spawning--;
+        if (thread)
+          _parked.push_back (thread);
+      }
+
+      /* the failure might be transient, meanwhile the registry creates the
+       * threads itself */
+      if (thread)
+        backoff = std::chrono::milliseconds (0);
+      else
+        {
+          backoff = std::max (backoff * 2, std::chrono::milliseconds (10));
+          backoff = std::min (backoff, std::chrono::milliseconds (10'000));
+          std::this_thread::sleep_for (backoff);
+        }
+    }
+}
+
+void
+Client_thread_pool::start_spawning (unsigned count)
+{
+  for (unsigned i = 0; i < count; i++)
+    {
+      pthread_t pthread;
+      int failed = pthread_create (
+          &pthread, nullptr,
+          [] (void *arg) -> void * {
+            static_cast<Client_thread_pool *> (arg)->spawn_loop ();
+            return nullptr;
+          },
+          this);
+      if (L4_UNLIKELY (failed))
+        throw Loggable_exception (-L4_ENOMEM, "Failed to create spawn thread");
+      pthread_detach (pthread);
+    }
+}
@@ -0,0 +1,166 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * Threads of the manager that serve the clients
+ *
+ * Every thread runs its own server loop and serves a single client at a time.
+ * Once the client deleted its gate, the thread is parked in a pool and bound
+ * to the next client that registers (see Options::thread_pool). Spawn threads
+ * keep the pool filled with new threads, thus the registry doesn't have to
+ * create them (see Options::spawn_threads).
+ */
+
+#pragma once
+
+#include "manager.h"
+
+#include <l4/sys/cxx/ipc_epiface>
+#include <l4/sys/ipc_gate>
+#include <l4/sys/thread>
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+
+/**
+ * @brief A thread that serves a client
+ *
+ * The thread object is also the irq that is triggered whenever an ipc gate
+ * bound to the thread was deleted (see L4::Thread::register_del_irq()).
+ */
+class Client_thread : public L4::Irqep_t<Client_thread>
+{
+private:
+  pthread_t _pthread;
+  L4::Cap<L4::Thread> _thread;
+  std::unique_ptr<Client_server> _server;
+
+  /**
+   * The client is bound by the registry thread, while the thread itself
+   * checks and ends the session, thus both fields are protected by _lock
+   */
+  std::mutex _lock;
+  /** gate of the current client, invalid while the thread is parked */
+  L4::Cap<L4::Ipc_gate> _client_gate;
+  /** releases the objects of the current client, called by the thread */
+  std::function<void (void)> _cleanup;
+  /** set by the thread before it enters its server loop */
+  bool _started = false;
+  /** the thread exits instead of serving a client (see destroy()) */
+  bool _destroyed = false;
+
+  Client_thread () = default;
+
+  /** deletes the irq and the object, called by the thread itself */
+  [[noreturn]] void exit ();
+
+public:
+  /**
+   * @brief Create a new thread with its server loop
+   *
+   * The thread is not started, it runs once it is bound to a scheduler with
+   * L4::Scheduler::run_thread().
+   *
+   * @throws Loggable_exception(-L4_ENOMEM) if the thread couldn't be created
+   */
+  static Client_thread *create ();
+
+  L4::Cap<L4::Thread>
+  thread () const
+  {
+    return _thread;
+  }
+
+  Client_server *
+  server () const
+  {
+    return _server.get ();
+  }
+
+  /**
+   * @brief Bind the thread to a client
+   *
+   * @param client_gate  Gate of the client, its deletion ends the session
+   * @param cleanup      Releases the objects of the client, it is called by
+   *                     the thread itself
+   */
+  void bind (L4::Cap<L4::Ipc_gate> client_gate,
+             std::function<void (void)> cleanup);
+
+  /**
+   * @brief Let a thread exit that isn't bound to a client
+   *
+   * This is used if the thread can't be parked. A thread that wasn't started
+   * yet is started on the scheduler of the manager, otherwise its irq is
+   * triggered. Either way the thread deletes itself, thus it must not be
+   * touched afterwards.
+   */
+  void destroy ();
+
+  /**
+   * Ends the session once the gate of the client was deleted. Afterwards the
+   * thread is parked or exits, if the pool is full. An exiting thread
+   * deletes its deletion irq first, a bound irq would keep the kernel object
+   * of the thread alive.
+   */
+  void handle_irq ();
+};
+
+/**
+ * @brief Parked client threads
+ *
+ * This is used by the registry, the client threads and the spawn threads.
+ */
+class Client_thread_pool
+{
+private:
+  std::mutex _lock;
+  std::list<Client_thread *> _parked;
+
+  /** number of threads the spawn threads are currently creating */
+  unsigned _spawning = 0;
+  /** signaled once a thread was taken out of the pool */
+  std::condition_variable _taken;
+
+  /**
+   * refill the pool, after a thread couldn't be created the next attempt is
+   * delayed
+   */
+  void spawn_loop ();
+
+public:
+  /**
+   * @return  A parked thread or nullptr if there is none
+   */
+  Client_thread *take ();
+
+  /**
+   * @brief Start threads that keep the pool filled with new client threads
+   *
+   * @param count  Number of spawn threads
+   *
+   * @throws Loggable_exception(-L4_ENOMEM) if a thread couldn't be created
+   */
+  void start_spawning (unsigned count);
+
+  /**
+   * @brief Put a thread whose client left into the pool
+   *
+   * @return  false if the pool is full, the thread has to exit in this case
+   */
+  bool park (Client_thread *thread);
+};
+
+/**
+ * Pool shared by the registry and all client threads
+ */
+extern Client_thread_pool client_threads;
@@ -0,0 +1,328 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "cpu_allocator.h"
+
+#include <l4/re/env>
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+Cpu_allocator cpu_allocator;
+
+std::array<unsigned, Cpu_allocator::Max_cpus>
+Cpu_allocator::by_load (unsigned &count) const
+{
+  std::array<unsigned, Max_cpus> order;
+  count = 0;
+  for (unsigned cpu = 0; cpu < Max_cpus; cpu++)
+    if (_cpus[cpu])
+      order[count++] = cpu;
+  std::stable_sort (order.begin (), order.begin () + count,
+                    [this] (unsigned a, unsigned b) {
+                      return _load[a] < _load[b];
+                    });
+  return order;
+}
+
+void
+Cpu_allocator::rebalance ()
+{
+  /* a client can only be moved within the word of its cpus */
+  for (unsigned word = 0; word < Max_cpus / Word_bits; word++)
+    rebalance (word);
+}
+
+void
+Cpu_allocator::rebalance (unsigned word)
+{
+  /* every move lowers the sum of the squared loads, thus this ends */
+  while (true)
+    {
+      unsigned all;
+      auto order = by_load (all);
+      /* keep the order of the cpus of this word */
+      unsigned count = 0;
+      for (unsigned i = 0; i < all; i++)
+        if (order[i] / Word_bits == word)
+          order[count++] = order[i];
+      if (count == 0)
+        return;
+      unsigned low = order[0];
+      unsigned high = order[count - 1];
+      if (_load[high] <= _load[low] + 1)
+        return;
+
+      auto movable = [low, high] (auto const &c) {
+        return c.second.cpus[high] and not c.second.cpus[low];
+      };
+      /* prefer a client whose other cpus share the cache with the new one */
+      auto client = std::find_if (
+          _clients.begin (), _clients.end (), [&] (auto const &c) {
+            if (not movable (c))
+              return false;
+            for (unsigned cpu = 0; cpu < Max_cpus; cpu++)
+              if (c.second.cpus[cpu] and cpu != high
+                  and _cache[cpu] != _cache[low])
+                return false;
+            return true;
+          });
+      if (client == _clients.end ())
+        client = std::find_if (_clients.begin (), _clients.end (), movable);
+      if (client == _clients.end ())
+        return;
+
+      client->second.cpus.reset (high);
+      client->second.cpus.set (low);
+      client->second.moved = true;
+      _load[high]--;
+      _load[low]++;
+    }
+}
+
+void
+Cpu_allocator::add (l4_sched_cpu_set_t const &cpus)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  /* every bit of the map stands for 2^granularity cpus */
+  unsigned width = 1U << cpus.granularity ();
+  for (unsigned bit = 0; bit < Word_bits; bit++)
+    if (cpus.map & (1UL << bit))
+      for (unsigned cpu = cpus.offset () + bit * width;
+           cpu < cpus.offset () + (bit + 1) * width and cpu < Max_cpus; cpu++)
+        _cpus.set (cpu);
+}
+
+void
+Cpu_allocator::set_topology (std::string const &description)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  unsigned cache = 0;
+  char const *pos = description.c_str ();
+  while (*pos)
+    {
+      char *end;
+      unsigned long first = strtoul (pos, &end, 10);
+      unsigned long last = first;
+      if (end != pos and *end == '-')
+        {
+          pos = end + 1;
+          last = strtoul (pos, &end, 10);
+        }
+      if (L4_UNLIKELY (end == pos or (*end and *end != ',') or first > last))
+        throw Loggable_exception (-L4_EINVAL, "Invalid topology '{:s}'",
+                                  description);
+
+      cache++;
+      /* cpus beyond Max_cpus are not used anyway */
+      for (auto cpu = first; cpu <= last and cpu < Max_cpus; cpu++)
+        _cache[cpu] = cache;
+      pos = *end ? end + 1 : end;
+    }
+}
+
+Cpu_allocator::Client
+Cpu_allocator::allocate (l4_umword_t min_cores, l4_umword_t max_cores,
+                         Cpu_set &cpus)
+{
+  if (L4_UNLIKELY (min_cores == 0 or min_cores > max_cores))
+    throw Loggable_exception (-L4_EINVAL, "Invalid core range {:d}-{:d}",
+                              min_cores, max_cores);
+
+  std::lock_guard<std::mutex> guard (_lock);
+  if (L4_UNLIKELY (_cpus.count () < min_cores))
+    throw Loggable_exception (-L4_ENOENT, "Only {:d} of {:d} cpus available",
+                              _cpus.count (), min_cores);
+
+  unsigned count;
+  auto order = by_load (count);
+  auto count_unused = [this] (std::vector<unsigned> const &cpus) {
+    return std::count_if (cpus.begin (), cpus.end (),
+                          [this] (unsigned cpu) { return _load[cpu] == 0; });
+  };
+
+  /* cpus of every group, sorted by their load. The cpus of a client have to
+   * be within one word (see ::affinity()), thus a group never spans several
+   * words. */
+  typedef std::pair<unsigned, unsigned> Group;
+  auto select = [&] (bool by_cache, std::vector<unsigned> &candidates) {
+    std::map<Group, std::vector<unsigned> > groups;
+    std::map<Group, unsigned> group_load;
+    for (unsigned i = 0; i < count; i++)
+      {
+        Group group{ order[i] / Word_bits, by_cache ? _cache[order[i]] : 0 };
+        groups[group].push_back (order[i]);
+        group_load[group] += _load[order[i]];
+      }
+
+    bool found = false;
+    bool found_unused = false;
+    unsigned found_load = 0;
+    for (auto const &group : groups)
+      {
+        if (group.second.size () < min_cores)
+          continue;
+        bool unused = count_unused (group.second) >= min_cores;
+        unsigned load = group_load[group.first];
+        if (found
+            and (found_unused > unused
+                 or (found_unused == unused and found_load <= load)))
+          continue;
+        candidates = group.second;
+        found = true;
+        found_unused = unused;
+        found_load = load;
+      }
+    return found;
+  };
+
+  /* the client thread and its workers should share a cache, unused cpus are
+   * preferred, then the least loaded cache -- this keeps heavy clients
+   * apart. Only if no cache has enough cpus, they are taken from a whole
+   * word. */
+  std::vector<unsigned> candidates;
+  if (L4_UNLIKELY (not select (true, candidates)
+                   and not select (false, candidates)))
+    throw Loggable_exception (-L4_ENOENT,
+                              "No {:d} cpus within a word of {:d} cpus",
+                              min_cores, Word_bits);
+
+  unsigned unused = count_unused (candidates);
+  /* a client doesn't get more than its minimum of shared cpus, they would
+   * reduce the share of the other clients */
+  unsigned selected_count = min_cores;
+  if (unused >= min_cores)
+    selected_count = std::min<l4_umword_t> (max_cores, unused);
+
+  Cpu_set selected;
+  for (unsigned i = 0; i < selected_count; i++)
+    {
+      selected.set (candidates[i]);
+      _load[candidates[i]]++;
+    }
+
+  Client client = _next_client++;
+  _clients[client] = Entry{ selected, false };
+  cpus = selected;
+  return client;
+}
+
+void
+Cpu_allocator::release (Client client)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  auto entry = _clients.find (client);
+  if (entry == _clients.end ())
+    return;
+
+  for (unsigned cpu = 0; cpu < Max_cpus; cpu++)
+    if (entry->second.cpus[cpu])
+      _load[cpu]--;
+  _clients.erase (entry);
+
+  rebalance ();
+  evict_schedulers ();
+}
+
+void
+Cpu_allocator::evict_schedulers ()
+{
+  std::lock_guard<std::mutex> guard (_scheduler_lock);
+  for (auto const &cached : _schedulers)
+    {
+      bool used = std::any_of (
+          _clients.begin (), _clients.end (),
+          [&] (auto const &c) { return c.second.cpus == cached.first; });
+      auto unused = std::find (_unused.begin (), _unused.end (), cached.first);
+      if (used and unused != _unused.end ())
+        _unused.erase (unused);
+      else if (not used and unused == _unused.end ())
+        _unused.push_back (cached.first);
+    }
+
+  /* a burst of reconnecting clients finds the schedulers of the ones that
+   * just left */
+  while (_unused.size () > Max_unused_schedulers)
+    {
+      _schedulers.erase (_unused.front ());
+      _unused.pop_front ();
+    }
+}
+
+unsigned
+Cpu_allocator::count (Client client)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  auto entry = _clients.find (client);
+  if (entry == _clients.end ())
+    return 0;
+  return entry->second.cpus.count ();
+}
+
+bool
+Cpu_allocator::moved (Client client, Cpu_set &cpus)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  auto entry = _clients.find (client);
+  if (entry == _clients.end () or not entry->second.moved)
+    return false;
+
+  entry->second.moved = false;
+  cpus = entry->second.cpus;
+  return true;
+}
+
+L4Re::Util::Shared_cap<L4::Scheduler>
+Cpu_allocator::scheduler (Cpu_set const &cpus)
+{
+  /* Note: moe's scheduler factory only accepts a single l4_umword_t as
+   * bitmap, thus it can only restrict the first word of cpus */
+  if ((cpus >> Word_bits).any ())
+    /* not managed by the Util::cap_alloc, thus never unmapped by the
+     * Shared_cap */
+    return L4Re::Util::Shared_cap<L4::Scheduler> (
+        L4Re::Env::env ()->scheduler ());
+
+  std::lock_guard<std::mutex> guard (_scheduler_lock);
+  auto cached = _schedulers.find (cpus);
+  if (cached != _schedulers.end ())
+    {
+      _unused.remove (cpus);
+      return cached->second;
+    }
+
+  auto scheduler = chkcap (L4Re::Util::make_shared_cap<L4::Scheduler> (),
+                           "allocate scheduler capability");
+  l4_mword_t limit = L4_SCHED_MAX_PRIO;
+  l4_mword_t offset = L4_SCHED_MIN_PRIO;
+  l4_umword_t bitmap = affinity (cpus).map;
+
+  auto create = L4Re::Env::env ()->user_factory ()->create<L4::Scheduler> (
+      scheduler.get ());
+  chksys (l4_msgtag_t (create << limit << offset << bitmap),
+          "Failed to create scheduler");
+  _schedulers[cpus] = scheduler;
+  return scheduler;
+}
+
+l4_sched_cpu_set_t
+Cpu_allocator::affinity (Cpu_set const &cpus)
+{
+  unsigned first = 0;
+  while (first < Max_cpus and not cpus[first])
+    first++;
+  unsigned offset = first - first % Word_bits;
+
+  l4_umword_t map = 0;
+  for (unsigned bit = 0; bit < Word_bits and offset + bit < Max_cpus; bit++)
+    if (cpus[offset + bit])
+      map |= 1UL << bit;
+  return l4_sched_cpu_set (offset, 0, map);
+}
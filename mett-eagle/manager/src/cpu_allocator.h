@@ -0,0 +1,213 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * Assignment of the cpus of the manager to its clients
+ *
+ * Every client gets its own cpus as long as there are free ones. Once the
+ * clients outnumber the cpus, several clients share a cpu. The allocator
+ * counts the clients of every cpu (each of them gets an equal share of the
+ * cpu) and places new clients on the least loaded cpus. If a client leaves,
+ * clients of more heavily shared cpus are moved to the released ones.
+ *
+ * A moved client is not migrated by the allocator, its thread has to pick up
+ * the new cpus itself (see ::moved()).
+ *
+ * If the cpus that share a last level cache are known, the cpus of a client
+ * are taken from a single cache. Its thread and workers thereby share the
+ * cache, while other clients are placed on the least loaded caches.
+ *
+ * The cpus of a client are always taken from a single word of the cpu bitmap
+ * (Word_bits cpus), thus they can be passed as affinity with an offset (see
+ * ::affinity()). The scheduler factory of moe only takes the first word, so
+ * only clients of this word get a scheduler of their own. Clients of further
+ * words use the scheduler of the manager, their threads are bound to their
+ * cpus by the affinity alone.
+ */
+
+#pragma once
+
+#include "manager.h"
+
+#include <l4/re/util/shared_cap>
+#include <l4/sys/scheduler>
+
+#include <array>
+#include <bitset>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class Cpu_allocator
+{
+public:
+  /** Number of cpus covered by one word of a cpu bitmap */
+  static constexpr unsigned Word_bits = sizeof (l4_sched_cpu_set_t::map) * 8;
+
+  /** Maximum number of cpus */
+  static constexpr unsigned Max_cpus = 16 * Word_bits;
+
+  /** Maximum number of cached schedulers no client uses */
+  static constexpr unsigned Max_unused_schedulers = 16;
+
+  /** Cpu bitmap that covers all cpus, starting with cpu 0 */
+  typedef std::bitset<Max_cpus> Cpu_set;
+
+  /** Identifies the cpus of a client, 0 is never used */
+  typedef unsigned long Client;
+
+private:
+  struct Entry
+  {
+    Cpu_set cpus;
+    /** set if the cpus changed since the client thread last checked */
+    bool moved;
+  };
+
+  /** this is used by the registry as well as by the client threads */
+  std::mutex _lock;
+
+  /** cpus accessible to the manager process */
+  Cpu_set _cpus;
+
+  /** number of clients that use a cpu */
+  std::array<unsigned, Max_cpus> _load{};
+
+  /** last level cache of a cpu, 0 for cpus with unknown cache */
+  std::array<unsigned, Max_cpus> _cache{};
+
+  std::map<Client, Entry> _clients;
+  Client _next_client = 1;
+
+  /**
+   * schedulers that were created for a set of cpus, they are kept after the
+   * last client with this set left (see ::evict_schedulers())
+   */
+  std::unordered_map<Cpu_set, L4Re::Util::Shared_cap<L4::Scheduler> >
+      _schedulers;
+  /** sets of _schedulers no client has, the least recently used first */
+  std::list<Cpu_set> _unused;
+  /** the creation of a scheduler shouldn't block the other operations */
+  std::mutex _scheduler_lock;
+
+  /** cpus of _cpus sorted by their load, the lowest index first on ties */
+  std::array<unsigned, Max_cpus> by_load (unsigned &count) const;
+
+  /**
+   * Move clients from the most to the least loaded cpu of every word until
+   * the loads differ by at most one
+   */
+  void rebalance ();
+  void rebalance (unsigned word);
+
+  /**
+   * Drop the least recently used schedulers of sets no client has anymore,
+   * once there are more than Max_unused_schedulers of them. Clients that
+   * still use such a scheduler keep it alive until they switched to their
+   * new one.
+   */
+  void evict_schedulers ();
+
+public:
+  /**
+   * @brief Add cpus that can be assigned to clients
+   *
+   * @param cpus  One word of a cpu bitmap, with the offset and granularity
+   *              it was queried with (see L4::Scheduler::info())
+   */
+  void add (l4_sched_cpu_set_t const &cpus);
+
+  /**
+   * @brief Set the cpus that share a last level cache
+   *
+   * @param description  Comma separated list of cpu ranges (e.g. "0-3,4-7"),
+   *                     each range shares a cache. Unlisted cpus are treated
+   *                     like a further cache.
+   *
+   * @throws Loggable_exception(-L4_EINVAL) if the description is malformed
+   */
+  void set_topology (std::string const &description);
+
+  /** Number of cpus that can be assigned to clients */
+  unsigned
+  size () const
+  {
+    return _cpus.count ();
+  }
+
+  /**
+   * @brief Select the cpus for a newly connected client
+   *
+   * The client gets up to max_cores unused cpus. If fewer than min_cores cpus
+   * are unused, it gets the min_cores least loaded cpus instead, which it
+   * shares with other clients. The cpus are taken from the least loaded cache
+   * that has enough of them, and always from a single word of the bitmap.
+   *
+   * @param min_cores  Minimum number of cpus that have to be selected
+   * @param max_cores  Maximum number of cpus that will be selected
+   * @param[out] cpus  Cpu bitmap with the selected cpus
+   *
+   * @return  Id of the client, it has to be passed to ::release() once the
+   *          client left
+   *
+   * @throws Loggable_exception(-L4_EINVAL) on an invalid range
+   * @throws Loggable_exception(-L4_ENOENT) if no word of the bitmap has
+   *         min_cores cpus
+   */
+  Client allocate (l4_umword_t min_cores, l4_umword_t max_cores,
+                   Cpu_set &cpus);
+
+  /**
+   * @brief Release the cpus of a client after its disconnection
+   *
+   * Other clients might be moved to the released cpus.
+   */
+  void release (Client client);
+
+  /** Number of cpus of a client, 0 for an unknown client */
+  unsigned count (Client client);
+
+  /**
+   * @brief Check whether the client was moved to other cpus
+   *
+   * @param client     Id of the client
+   * @param[out] cpus  The new cpu bitmap of the client, if it was moved
+   *
+   * @return  true once after every move of the client
+   */
+  bool moved (Client client, Cpu_set &cpus);
+
+  /**
+   * @brief Get a scheduler that only uses the given cpus
+   *
+   * The scheduler is created once per set of cpus and shared by all clients
+   * with that set. It is kept as long as a client has this set. Sets beyond
+   * the first word of the bitmap get the scheduler of the manager, which
+   * doesn't restrict the cpus itself.
+   *
+   * Note: Threads have to be run with the ::affinity() of the set in either
+   * case.
+   *
+   * @throws L4::Runtime_error if the scheduler couldn't be created
+   */
+  L4Re::Util::Shared_cap<L4::Scheduler> scheduler (Cpu_set const &cpus);
+
+  /**
+   * @brief Get the affinity that selects the given cpus
+   *
+   * @param cpus  Cpus of a client, they are within a single word
+   */
+  static l4_sched_cpu_set_t affinity (Cpu_set const &cpus);
+};
+
+/**
+ * Allocator shared by the registry and all client threads
+ */
+extern Cpu_allocator cpu_allocator;
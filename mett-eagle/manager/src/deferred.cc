@@ -0,0 +1,35 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "deferred.h"
+
+void
+Deferred::schedule (Client_server *server, std::function<void (void)> work)
+{
+  /* a timeout of 'now' will expire as soon as the server loop waits */
+  server->add_timeout (new Deferred (work), server->now ());
+}
+
+void
+Deferred::expired ()
+{
+  /* the timeout was already removed from the queue */
+  try
+    {
+      _work ();
+    }
+  catch (Loggable_exception &e)
+    {
+      log<ERROR> (e);
+    }
+  catch (L4::Runtime_error &e)
+    {
+      log<ERROR> (e);
+    }
+  delete this;
+}
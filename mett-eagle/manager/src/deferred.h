@@ -0,0 +1,67 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * Work that is executed by a client thread after its current reply was sent
+ *
+ * The client server loop uses a timeout queue. A timeout that already expired
+ * is handled right after the reply to the current request was sent and before
+ * the next request is received. This is used to move work off the critical
+ * path of an invocation.
+ */
+
+#pragma once
+
+#include "manager.h"
+
+#include <l4/sys/cxx/ipc_timeout_queue>
+
+#include <functional>
+#include <memory>
+
+class Deferred : public L4::Ipc_svr::Timeout
+{
+private:
+  std::function<void (void)> _work;
+
+  Deferred (std::function<void (void)> work) : _work (work) {}
+
+public:
+  /**
+   * @brief Schedule work on the thread of a client server
+   *
+   * Note: This has to be called by the thread that is running the server
+   * loop of the client.
+   *
+   * @param server  Server loop of the client
+   * @param work    The work, errors thrown by it will only be logged
+   */
+  static void schedule (Client_server *server,
+                        std::function<void (void)> work);
+
+  /**
+   * @brief Schedule work on an object that might be destroyed before the work
+   * is executed, the work is skipped in this case
+   *
+   * @param server  Server loop of the client
+   * @param owner   The object, only a weak reference is kept
+   * @param work    Called with the object
+   */
+  template <typename T, typename Work>
+  static void
+  schedule (Client_server *server, std::shared_ptr<T> const &owner, Work work)
+  {
+    std::weak_ptr<T> weak = owner;
+    schedule (server, [weak, work] {
+      if (auto object = weak.lock ())
+        work (*object);
+    });
+  }
+
+  void expired () override;
+};
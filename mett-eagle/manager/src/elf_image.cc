@@ -0,0 +1,81 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "elf_image.h"
+
+#include <l4/re/env>
+
+#include <cstring>
+#include <elf.h>
+
+#if L4_MWORD_BITS == 64
+typedef Elf64_Ehdr Elf_Ehdr;
+typedef Elf64_Phdr Elf_Phdr;
+static constexpr unsigned char Elf_class = ELFCLASS64;
+#else
+typedef Elf32_Ehdr Elf_Ehdr;
+typedef Elf32_Phdr Elf_Phdr;
+static constexpr unsigned char Elf_class = ELFCLASS32;
+#endif
+
+Elf_image::Elf_image (L4::Cap<L4Re::Dataspace> ds) : _ds (ds)
+{
+  _size = ds->size ();
+  if (L4_UNLIKELY (_size < sizeof (Elf_Ehdr)))
+    throw Loggable_exception (-L4_EINVAL, "Binary too small ({:d} bytes)",
+                              _size);
+
+  chksys (L4Re::Env::env ()->rm ()->attach (
+              &_region, _size, L4Re::Rm::F::Search_addr | L4Re::Rm::F::R,
+              L4::Ipc::make_cap (ds, L4_CAP_FPAGE_RO), 0),
+          "attach binary");
+
+  auto ehdr = reinterpret_cast<Elf_Ehdr const *> (_region.get ());
+  if (L4_UNLIKELY (memcmp (ehdr->e_ident, ELFMAG, SELFMAG) != 0))
+    throw Loggable_exception (-L4_EINVAL, "Binary is not an ELF file");
+  if (L4_UNLIKELY (ehdr->e_ident[EI_CLASS] != Elf_class))
+    throw Loggable_exception (-L4_EINVAL, "Binary has the wrong ELF class");
+  if (L4_UNLIKELY (ehdr->e_type != ET_EXEC and ehdr->e_type != ET_DYN))
+    throw Loggable_exception (-L4_EINVAL, "Binary is not executable");
+  if (L4_UNLIKELY (ehdr->e_phentsize != sizeof (Elf_Phdr)
+                   or ehdr->e_phoff > _size
+                   or ehdr->e_phnum
+                          > (_size - ehdr->e_phoff) / sizeof (Elf_Phdr)))
+    throw Loggable_exception (-L4_EINVAL, "Invalid program headers");
+
+  bool loadable = false;
+  auto phdrs = reinterpret_cast<Elf_Phdr const *> (_region.get ()
+                                                   + ehdr->e_phoff);
+  for (unsigned i = 0; i < ehdr->e_phnum; i++)
+    {
+      auto const &phdr = phdrs[i];
+      /* every referenced part of the file has to be inside the binary */
+      if (L4_UNLIKELY (phdr.p_offset > _size
+                       or phdr.p_filesz > _size - phdr.p_offset))
+        throw Loggable_exception (-L4_EINVAL,
+                                  "Program header {:d} exceeds the binary", i);
+      switch (phdr.p_type)
+        {
+        case PT_LOAD:
+          if (L4_UNLIKELY (phdr.p_filesz > phdr.p_memsz))
+            throw Loggable_exception (-L4_EINVAL, "Invalid segment {:d}", i);
+          loadable = true;
+          break;
+        case PT_INTERP:
+          /* the path has to be null terminated */
+          if (L4_UNLIKELY (phdr.p_filesz == 0
+                           or _region.get ()[phdr.p_offset + phdr.p_filesz - 1]
+                                  != '\0'))
+            throw Loggable_exception (-L4_EINVAL, "Invalid interpreter");
+          break;
+        }
+    }
+
+  if (L4_UNLIKELY (not loadable))
+    throw Loggable_exception (-L4_EINVAL, "Binary has no loadable segment");
+}
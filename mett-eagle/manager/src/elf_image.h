@@ -0,0 +1,70 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * ELF binaries that were parsed and validated once
+ *
+ * The whole binary stays attached to the manager (read-only). This allows the
+ * Elf_loader to read the headers of every new worker without attaching and
+ * detaching the binary again (see App_model::local_attach_ds()). The layout
+ * itself is still taken from the headers by the loader, the image only
+ * validates it once, thus malformed binaries are rejected on creation.
+ */
+
+#pragma once
+
+#include "manager.h"
+
+#include <l4/re/dataspace>
+#include <l4/re/rm>
+#include <l4/sys/capability>
+
+class Elf_image
+{
+private:
+  L4::Cap<L4Re::Dataspace> _ds;
+  L4Re::Rm::Unique_region<char const *> _region;
+  unsigned long _size;
+
+public:
+  /**
+   * @brief Attach and parse the binary
+   *
+   * Note: The dataspace has to stay valid as long as the image exists.
+   *
+   * @param ds  Dataspace that contains the binary
+   *
+   * @throws Loggable_exception(-L4_EINVAL) in case the binary is malformed or
+   *         not executable on this platform
+   */
+  explicit Elf_image (L4::Cap<L4Re::Dataspace> ds);
+
+  /**
+   * @brief Get a pointer to a range of the binary
+   *
+   * @return  nullptr if the range is not backed by this image
+   */
+  char const *
+  data (L4::Cap<L4Re::Dataspace> ds, unsigned long offset,
+        unsigned long size) const
+  {
+    if (ds != _ds or offset > _size or size > _size - offset)
+      return nullptr;
+    return _region.get () + offset;
+  }
+
+  /**
+   * Check if an address points into the attached binary
+   */
+  bool
+  contains (l4_addr_t addr) const
+  {
+    return addr >= l4_addr_t (_region.get ())
+           and addr < l4_addr_t (_region.get ()) + _size;
+  }
+};
@@ -0,0 +1,72 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "kobject_pool.h"
+
+#include <l4/re/env>
+#include <l4/re/util/cap_alloc>
+
+Kobject_pool::~Kobject_pool ()
+{
+  for (auto slot : _slots)
+    L4Re::Util::cap_alloc.free (slot);
+}
+
+void
+Kobject_pool::refill ()
+{
+  Deferred::schedule (_server, shared_from_this (), [] (Kobject_pool &pool) {
+    /* every worker needs two slots (task and thread) and one region map */
+    while (pool._slots.size () < 2 * options.kobject_pool)
+      pool._slots.push_back (chkcap (L4Re::Util::cap_alloc.alloc<void> (),
+                                     "allocate cap", -L4_ENOMEM));
+    while (pool._rms.size () < options.kobject_pool)
+      {
+        auto rm = chkcap (L4Re::Util::make_unique_cap<L4Re::Rm> (),
+                          "allocating region-map cap");
+        chksys (L4Re::Env::env ()->user_factory ()->create (rm.get ()),
+                "allocating new region map");
+        pool._rms.push_back (std::move (rm));
+      }
+  });
+}
+
+L4::Cap<void>
+Kobject_pool::take_slot ()
+{
+  refill ();
+  if (_slots.empty ())
+    return chkcap (L4Re::Util::cap_alloc.alloc<void> (), "allocate cap",
+                   -L4_ENOMEM);
+  auto slot = _slots.front ();
+  _slots.pop_front ();
+  return slot;
+}
+
+void
+Kobject_pool::put_slot (L4::Cap<void> slot)
+{
+  /* delete the object, the slot is empty afterwards */
+  L4Re::Env::env ()->task ()->unmap (slot.fpage (),
+                                     L4_FP_ALL_SPACES | L4_FP_DELETE_OBJ);
+  if (_slots.size () < 2 * options.kobject_pool)
+    _slots.push_back (slot);
+  else
+    L4Re::Util::cap_alloc.free (slot);
+}
+
+L4Re::Util::Unique_cap<L4Re::Rm>
+Kobject_pool::take_rm ()
+{
+  refill ();
+  if (_rms.empty ())
+    return L4Re::Util::Unique_cap<L4Re::Rm> ();
+  auto rm = std::move (_rms.front ());
+  _rms.pop_front ();
+  return rm;
+}
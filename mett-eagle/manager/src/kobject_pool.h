@@ -0,0 +1,129 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * Recycling of the kernel objects of worker processes
+ *
+ * Every client has a pool of capability slots (used for the task and thread of
+ * a worker) and of region maps that were created ahead of time. The slots are
+ * put back into the pool once the objects they referenced are deleted.
+ */
+
+#pragma once
+
+#include "deferred.h"
+#include "manager.h"
+
+#include <l4/re/env>
+#include <l4/re/rm>
+#include <l4/re/util/cap_alloc>
+#include <l4/re/util/unique_cap>
+#include <l4/sys/capability>
+
+#include <list>
+#include <memory>
+
+class Kobject_pool : public std::enable_shared_from_this<Kobject_pool>
+{
+private:
+  /** server loop of the client thread, used to defer work */
+  Client_server *_server;
+
+  /** empty capability slots */
+  std::list<L4::Cap<void> > _slots;
+
+  /** region maps created by the user factory of the manager */
+  std::list<L4Re::Util::Unique_cap<L4Re::Rm> > _rms;
+
+  void refill ();
+
+public:
+  explicit Kobject_pool (Client_server *server) : _server (server) {}
+
+  ~Kobject_pool ();
+
+  /**
+   * @brief Take an empty capability slot
+   *
+   * The pool will be refilled once the current reply was sent.
+   */
+  L4::Cap<void> take_slot ();
+
+  /**
+   * @brief Put back a capability slot
+   *
+   * The object the slot references will be deleted.
+   */
+  void put_slot (L4::Cap<void> slot);
+
+  /**
+   * @brief Take a region map that was created by the user factory
+   *
+   * The pool will be refilled once the current reply was sent.
+   */
+  L4Re::Util::Unique_cap<L4Re::Rm> take_rm ();
+
+  /**
+   * @brief Capability slot that is returned to its pool on destruction
+   *
+   * This works like a L4Re::Util::Unique_del_cap, but the slot is reused
+   * instead of being freed. Without pool the slot is taken from the
+   * L4Re::Util::cap_alloc.
+   */
+  template <typename T> class Cap
+  {
+  private:
+    std::shared_ptr<Kobject_pool> _pool;
+    L4::Cap<T> _cap;
+
+  public:
+    explicit Cap (std::shared_ptr<Kobject_pool> pool) : _pool (pool)
+    {
+      if (_pool)
+        _cap = L4::cap_cast<T> (_pool->take_slot ());
+      else
+        _cap = chkcap (L4Re::Util::cap_alloc.alloc<T> (), "allocate cap");
+    }
+    Cap (Cap const &) = delete;
+    Cap &operator= (Cap const &) = delete;
+
+    ~Cap ()
+    {
+      if (_pool)
+        _pool->put_slot (_cap);
+      else
+        L4Re::Util::cap_alloc.free (_cap,
+                                    L4Re::Env::env ()->task ().cap (),
+                                    L4_FP_ALL_SPACES | L4_FP_DELETE_OBJ);
+    }
+
+    L4::Cap<T>
+    get () const
+    {
+      return _cap;
+    }
+
+    L4::Cap<T>
+    operator-> () const
+    {
+      return _cap;
+    }
+
+    l4_fpage_t
+    fpage (unsigned rights = L4_CAP_FPAGE_RWS) const
+    {
+      return _cap.fpage (rights);
+    }
+
+    l4_cap_idx_t
+    cap () const
+    {
+      return _cap.cap ();
+    }
+  };
+};
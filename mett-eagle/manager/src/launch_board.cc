@@ -0,0 +1,92 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "launch_board.h"
+
+#include <algorithm>
+
+Launch_board launch_board;
+
+bool
+Launch_board::Member::complete (std::function<void (void)> work)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  if (_closed)
+    return false;
+  _completions.push_back (work);
+  obj_cap ()->trigger ();
+  return true;
+}
+
+void
+Launch_board::Member::close ()
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  _closed = true;
+  _completions.clear ();
+}
+
+void
+Launch_board::Member::handle_irq ()
+{
+  /* the work handed back might hand back work itself */
+  std::list<std::function<void (void)> > completions;
+  {
+    std::lock_guard<std::mutex> guard (_lock);
+    completions.swap (_completions);
+  }
+  for (auto &work : completions)
+    work ();
+
+  Job job;
+  while (_idle and launch_board.steal (job))
+    job (*this);
+}
+
+void
+Launch_board::join (Member *member)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  _members.push_back (member);
+}
+
+void
+Launch_board::leave (Member *member)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  _members.remove (member);
+}
+
+bool
+Launch_board::post (Member const &owner, Job job)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  auto thief = std::find_if (_members.begin (), _members.end (),
+                             [&owner] (Member const *member) {
+                               return member != &owner and member->_idle;
+                             });
+  if (thief == _members.end ())
+    return false;
+
+  _jobs.push_back (job);
+  (*thief)->obj_cap ()->trigger ();
+  /* wake up another thread next time */
+  _members.splice (_members.end (), _members, thief);
+  return true;
+}
+
+bool
+Launch_board::steal (Job &job)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  if (_jobs.empty ())
+    return false;
+  job = std::move (_jobs.front ());
+  _jobs.pop_front ();
+  return true;
+}
@@ -0,0 +1,157 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * Loading of workers that can be stolen by idle client threads
+ *
+ * A client thread posts the loading of a worker (see Worker::prelaunch()) to
+ * the global board, in case another client thread is idle. The idle thread is
+ * woken up by its irq and executes the loading instead of the owner. The
+ * loaded worker is handed back to the owner thread, again with its irq.
+ */
+
+#pragma once
+
+#include "manager.h"
+
+#include <l4/re/util/shared_cap>
+#include <l4/sys/cxx/ipc_epiface>
+#include <l4/sys/irq>
+#include <l4/sys/scheduler>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+
+class Launch_board
+{
+public:
+  class Member;
+
+  /**
+   * Work that is executed by the thread that took it from the board, the
+   * member of that thread is passed as argument
+   */
+  typedef std::function<void (Member &thief)> Job;
+
+  /**
+   * @brief A client thread that takes part in the work stealing
+   *
+   * The irq of the member is bound to the client thread. It is triggered if
+   * there is work to steal or the thread got work handed back.
+   */
+  class Member : public L4::Irqep_t<Member>
+  {
+    friend class Launch_board;
+
+  private:
+    /** scheduler of the client thread */
+    L4Re::Util::Shared_cap<L4::Scheduler> _scheduler;
+    /** cpus of the client thread (see Cpu_allocator::affinity()) */
+    l4_sched_cpu_set_t _affinity;
+
+    /** set while the thread doesn't serve an invocation */
+    std::atomic<bool> _idle{ true };
+
+    std::mutex _lock;
+    /** work handed back by other threads */
+    std::list<std::function<void (void)> > _completions;
+    /** set once the client thread is gone */
+    bool _closed = false;
+
+  public:
+    Member (L4Re::Util::Shared_cap<L4::Scheduler> scheduler,
+            l4_sched_cpu_set_t affinity)
+        : _scheduler (scheduler), _affinity (affinity)
+    {
+    }
+
+    L4Re::Util::Shared_cap<L4::Scheduler> const &
+    scheduler () const
+    {
+      return _scheduler;
+    }
+
+    l4_sched_cpu_set_t
+    affinity () const
+    {
+      return _affinity;
+    }
+
+    /** has to be called by the client thread */
+    void
+    set_scheduler (L4Re::Util::Shared_cap<L4::Scheduler> scheduler,
+                   l4_sched_cpu_set_t affinity)
+    {
+      _scheduler = scheduler;
+      _affinity = affinity;
+    }
+
+    void
+    set_idle (bool idle)
+    {
+      _idle = idle;
+    }
+
+    /**
+     * @brief Hand work back to the client thread of this member
+     *
+     * This can be called by any thread.
+     *
+     * @return  false if the client thread is already gone, the work will not
+     *          be executed in that case
+     */
+    bool complete (std::function<void (void)> work);
+
+    /**
+     * @brief Stop accepting work, has to be called by the client thread
+     * before it leaves
+     */
+    void close ();
+
+    /**
+     * Executes the work handed back to this thread and steals work of other
+     * threads while the thread is idle
+     */
+    void handle_irq ();
+  };
+
+private:
+  std::mutex _lock;
+  std::list<Member *> _members;
+  std::deque<Job> _jobs;
+
+public:
+  void join (Member *member);
+  void leave (Member *member);
+
+  /**
+   * @brief Post work of a client thread, if another thread is idle
+   *
+   * @param owner  Member of the posting thread, it will not be woken up
+   * @param job    The work
+   *
+   * @return  false if no other thread is idle, the caller has to execute the
+   *          work itself in this case
+   */
+  bool post (Member const &owner, Job job);
+
+  /**
+   * @brief Take the oldest posted work
+   *
+   * @return  false if there is no work
+   */
+  bool steal (Job &job);
+};
+
+/**
+ * Board shared by all client threads
+ */
+extern Launch_board launch_board;
@@ -0,0 +1,70 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "library_cache.h"
+
+#include <l4/re/util/env_ns>
+
+/**
+ * @see library_cache.h
+ */
+Library_cache library_cache;
+
+Library_cache::Entry
+Library_cache::open (std::string const &file)
+{
+  {
+    std::lock_guard<std::mutex> guard (_lock);
+    auto cached = _entries.find (file);
+    if (cached != _entries.end ())
+      return cached->second;
+  }
+
+  /* the namespace is only asked if the file isn't cached (anymore) */
+  L4Re::Util::Shared_cap<L4Re::Dataspace> ds (
+      L4Re::Util::Env_ns{}.query<L4Re::Dataspace> (file.c_str ()));
+  if (L4_UNLIKELY (not ds.is_valid ()))
+    throw Loggable_exception (-L4_ENOENT, "Couldn't find file '{:s}'", file);
+
+  Entry entry;
+  entry.ds = ds;
+
+  try
+    {
+      /* the image keeps its dataspace, it might outlive the entry */
+      entry.image = std::shared_ptr<Elf_image const> (
+          new Elf_image (ds.get ()),
+          [ds] (Elf_image const *image) { delete image; });
+    }
+  catch (Loggable_exception &e)
+    {
+      /* the file is still usable, it just can't be served from the cache */
+      log<WARN> ("'{:s}' is not cached: {:s}", file, e.msg ());
+    }
+
+  std::lock_guard<std::mutex> guard (_lock);
+  /* another thread might have resolved the file in the meantime */
+  return _entries.emplace (file, entry).first->second;
+}
+
+std::shared_ptr<Elf_image const>
+Library_cache::image (L4::Cap<L4Re::Dataspace> ds)
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  for (auto const &[name, entry] : _entries)
+    if (entry.ds.get () == ds)
+      return entry.image;
+  return nullptr;
+}
+
+void
+Library_cache::invalidate ()
+{
+  std::lock_guard<std::mutex> guard (_lock);
+  _entries.clear ();
+}
@@ -0,0 +1,83 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * Cache of files that are loaded into every worker
+ *
+ * The files (e.g. the dynamic loader or the python runtime) are resolved in
+ * the namespace of the manager and parsed as Elf_image once. Launches use the
+ * cached entry without asking the namespace again. The cache is only dropped
+ * by ::invalidate() (e.g. after a failed load, see Worker::launch()), thus a
+ * rebound file is picked up by the following lookup. The cache is shared by
+ * all client threads.
+ */
+
+#pragma once
+
+#include "elf_image.h"
+#include "manager.h"
+
+#include <l4/re/dataspace>
+#include <l4/re/util/shared_cap>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class Library_cache
+{
+public:
+  struct Entry
+  {
+    L4Re::Util::Shared_cap<L4Re::Dataspace> ds;
+    /* nullptr if the file is not an ELF binary */
+    std::shared_ptr<Elf_image const> image;
+  };
+
+private:
+  std::mutex _lock;
+  std::map<std::string, Entry> _entries;
+
+public:
+  /**
+   * @brief Resolve a file inside the namespace of the manager
+   *
+   * Only the first lookup (and the first one after ::invalidate()) asks the
+   * namespace and parses the file, later ones return the cached entry.
+   *
+   * @param file  Path of the file (e.g. 'rom/libld-l4.so')
+   *
+   * @throws Loggable_exception(-L4_ENOENT) if the file doesn't exist
+   */
+  Entry open (std::string const &file);
+
+  /**
+   * @brief Get the cached image of a dataspace
+   *
+   * The caller has to keep the image as long as it uses its memory, the
+   * entry might be replaced in the meantime.
+   *
+   * @return  nullptr if the dataspace is not cached (or no ELF binary)
+   */
+  std::shared_ptr<Elf_image const> image (L4::Cap<L4Re::Dataspace> ds);
+
+  /**
+   * @brief Drop all entries, the files are resolved again on their next
+   * lookup
+   *
+   * Workers that are still loading a dropped image keep it (and its
+   * dataspace) alive.
+   */
+  void invalidate ();
+};
+
+/**
+ * Global cache used by all client threads
+ */
+extern Library_cache library_cache;
@@ -7,19 +7,25 @@
  */
 
 #include "manager.h"
+#include "client_thread.h"
+#include "cpu_allocator.h"
 #include "manager_registry.h"
 
 #include <l4/liblog/exc_log_dispatch>
 
 #include <l4/re/util/object_registry>
 
-using namespace L4Re::LibLog;
+#include <algorithm>
+#include <cstdlib>
+#include <getopt.h>
+#include <string>
 
+using namespace L4Re::LibLog;
 
 /**
  * @see manager.h
  */
-std::bitset<sizeof (l4_sched_cpu_set_t::map) * 8> available_cpus;
+Options options;
 
 /**
  * This object will handle the registration of clients.
@@ -34,12 +40,143 @@ L4Re::Util::Registry_server<> register_server;
  * in the mett-eagle.cfg
  */
 int
-main (const int /* argc */, const char *const /* argv */[])
+main (const int argc, char *const argv[])
 try
   {
     // l4_debugger_set_object_name(L4Re::Env::env()->task().cap(), "mngr");
     // l4_debugger_set_object_name(L4Re::Env::env()->main_thread().cap(), "mngr reg");
 
+    /* parsing command line options using GNUs getopt */
+
+    // clang-format off
+    option long_options[] = {
+      { "pool-size",     required_argument, nullptr, 'p' },
+      { "keep-alive",    required_argument, nullptr, 'k' },
+      { "zygote",        no_argument,       nullptr, 'z' },
+      { "prelaunch",     no_argument,       nullptr, 'l' },
+      { "steal",         required_argument, nullptr, 'w' },
+      { "stack-pool",    required_argument, nullptr, 's' },
+      { "kobject-pool",  required_argument, nullptr, 'o' },
+      { "topology",      required_argument, nullptr, 't' },
+      { "thread-pool",   required_argument, nullptr, 'c' },
+      { "spawn-threads", required_argument, nullptr, 'n' },
+      { "help",          no_argument,       nullptr, 'h' },
+      { nullptr,         0,                 nullptr, 0   },
+    };
+    // clang-format on
+
+    opterr = 0; // do not print default error message
+    for (int option, index;
+         (option = getopt_long (argc, argv, "p:k:zlw:s:o:t:c:n:h", long_options,
+                                &index))
+         != -1;)
+      switch (option)
+        {
+        case 'p':
+          options.pool_size = std::stoul (optarg);
+          break;
+        case 'k':
+          options.keep_alive = std::chrono::milliseconds (std::stoul (optarg));
+          break;
+        case 'z':
+          options.zygote = true;
+          break;
+        case 'l':
+          options.prelaunch = true;
+          break;
+        case 'w':
+          if (std::string (optarg) == "owner")
+            options.steal = Steal_policy::OWNER;
+          else if (std::string (optarg) == "stealer")
+            options.steal = Steal_policy::STEALER;
+          else
+            {
+              log<ERROR> ("unknown steal policy '{:s}'", optarg);
+              return -L4_EINVAL;
+            }
+          break;
+        case 's':
+          options.stack_pool = std::stoul (optarg);
+          break;
+        case 'o':
+          options.kobject_pool = std::stoul (optarg);
+          break;
+        case 't':
+          options.topology = optarg;
+          break;
+        case 'c':
+          options.thread_pool = std::stoul (optarg);
+          break;
+        case 'n':
+          options.spawn_threads = std::stoul (optarg);
+          break;
+        default:
+          log<WARN> ("unknown option '{:s}'", argv[optind - 1]);
+          [[fallthrough]];
+        case 'h':
+          log<INFO> ("{:s} - the mett-eagle manager", argv[0]);
+          log<INFO> ("USAGE:");
+          log<INFO> ("{:s} [OPTION]...", argv[0]);
+          log<INFO> ("OPTIONS");
+          log<INFO> ("  -p --pool-size=NUM");
+          log<INFO> ("    keep up to NUM idle workers per client (default 0)");
+          log<INFO> ("  -k --keep-alive=MS");
+          log<INFO> ("    destroy idle workers after MS milliseconds");
+          log<INFO> ("  -z --zygote");
+          log<INFO> ("    prepare a fresh worker for the next invocation");
+          log<INFO> ("  -l --prelaunch");
+          log<INFO> ("    load the worker for the next invocation ahead of time");
+          log<INFO> ("  -w --steal=POLICY");
+          log<INFO> ("    let idle clients load prelaunched workers");
+          log<INFO> ("    POLICY 'owner' or 'stealer' selects the cpus they run on");
+          log<INFO> ("  -s --stack-pool=NUM");
+          log<INFO> ("    keep NUM spare worker stacks per client (default 0)");
+          log<INFO> ("  -o --kobject-pool=NUM");
+          log<INFO> ("    keep kernel objects for NUM workers per client "
+                     "(default 0)");
+          log<INFO> ("  -t --topology=CPUS,...");
+          log<INFO> ("    cpu ranges (e.g. 0-3,4-7) that share a last level "
+                     "cache");
+          log<INFO> ("  -c --thread-pool=NUM");
+          log<INFO> ("    keep up to NUM threads of left clients for new ones "
+                     "(default 0)");
+          log<INFO> ("  -n --spawn-threads=NUM");
+          log<INFO> ("    create the threads of new clients ahead of time with "
+                     "NUM threads");
+          log<INFO> ("  -h --help");
+          log<INFO> ("    show this help message");
+          if (option != 'h')
+            return -L4_EINVAL;
+          return EXIT_SUCCESS;
+        }
+
+    /* zygotes are stored in the worker pool */
+    if (options.zygote and options.pool_size == 0)
+      {
+        log<WARN> ("Zygote mode needs a worker pool, using pool size 1");
+        options.pool_size = 1;
+      }
+
+    if (options.steal != Steal_policy::NONE and not options.prelaunch)
+      log<WARN> ("Work stealing needs prelaunch mode, it has no effect");
+
+    /* the spawned threads are stored in the thread pool */
+    if (options.spawn_threads and options.thread_pool == 0)
+      {
+        log<WARN> ("Spawn threads need a thread pool, using pool size {}",
+                   options.spawn_threads);
+        options.thread_pool = options.spawn_threads;
+      }
+
+    log<INFO> ("Worker pool size set to {}, keep alive {}ms, zygote={}, "
+               "prelaunch={}, steal={}",
+               options.pool_size, options.keep_alive.count (), options.zygote,
+               options.prelaunch, static_cast<int> (options.steal));
+    log<INFO> ("Stack pool size set to {}, kernel object pool size set to {}, "
+               "thread pool size set to {} ({} spawn threads)",
+               options.stack_pool, options.kobject_pool, options.thread_pool,
+               options.spawn_threads);
+
     /**
      * Query available cpu-set which can be distributed to clients
      */
@@ -51,11 +188,29 @@ try
     /* reserve last cpu for all clients and manager registry thread */
     // cpus.map &= ~1LL;
 
-    /* update global bitmap */
-    available_cpus = cpus.map;
+    /* these cpus are distributed to the clients */
+    cpu_allocator.add (cpus);
+    /* the bitmap only covers one word of cpus, the following ones are
+     * queried with an offset */
+    for (l4_umword_t offset = Cpu_allocator::Word_bits;
+         offset < cpu_max and offset < Cpu_allocator::Max_cpus;
+         offset += Cpu_allocator::Word_bits)
+      {
+        l4_sched_cpu_set_t more{ l4_sched_cpu_set (offset, 0) };
+        chksys (L4Re::Env::env ()->scheduler ()->info (&cpu_max, &more),
+                "failed to query scheduler info");
+        cpu_allocator.add (more);
+      }
+    if (cpu_max > Cpu_allocator::Max_cpus)
+      log<WARN> ("Only the first {:d} of {:d} cpus are used",
+                 Cpu_allocator::Max_cpus, cpu_max);
+    if (not options.topology.empty ())
+      cpu_allocator.set_topology (options.topology);
 
     log<INFO> ("Scheduler info (available cpus) :: {:0{}b} => {:d}/{:d}",
-               cpus.map, cpu_max, available_cpus.count (), cpu_max);
+               cpus.map,
+               std::min<l4_umword_t> (cpu_max, Cpu_allocator::Word_bits),
+               cpu_allocator.size (), cpu_max);
 
     /*
      * Associate the 'server' endpoint that was already
@@ -67,6 +222,8 @@ try
                   "Couldn't register service, is there a 'server' in "
                   "the caps table?");
 
+    client_threads.start_spawning (options.spawn_threads);
+
     log<INFO> ("Starting Mett-Eagle registry server!");
 
     // start server loop -- loop will not return!
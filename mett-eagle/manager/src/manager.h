@@ -32,14 +32,118 @@ using L4Re::chksys;
 using L4Re::LibLog::Loggable_exception;
 using namespace L4Re::LibLog;
 
-#include <bitset>
-#include <l4/sys/scheduler>
+#include <l4/re/util/br_manager>
+#include <l4/re/util/object_registry>
 /**
- * Cpu bitmap of cpus accessible to the manager process
- * that are not currently assigned to clients.
+ * Server loop of the client threads
  *
- * Currently this map only supports up to 64 CPUs, but even moe
- * only supports an l4_umword_t as bitmap for the creation of L4::Scheduler
- * objects
+ * Br_manager is necessary to handle the demand of cap slots. They are used
+ * e.g. to receive the Dataspace of a client while creating a new action.
+ * The timeout queue is used to defer work until the reply was sent (see
+ * deferred.h).
  */
-extern std::bitset<sizeof (l4_sched_cpu_set_t::map) * 8> available_cpus;
\ No newline at end of file
+typedef L4Re::Util::Registry_server<L4Re::Util::Br_manager_timeout_hooks>
+    Client_server;
+
+#include <chrono>
+#include <string>
+/**
+ * Policy of the work stealing between client threads (see launch_board.h)
+ */
+enum class Steal_policy
+{
+  /** no work stealing */
+  NONE,
+  /** the stolen worker runs on the cpus of its owner */
+  OWNER,
+  /** the stolen worker runs on the cpus of the stealing thread */
+  STEALER,
+};
+
+/**
+ * Options of the manager that can be set using command line arguments.
+ *
+ * @see manager.cc for the argument parsing
+ */
+struct Options
+{
+  /**
+   * Maximum number of idle worker processes that are kept alive per client
+   * to handle further invocations of the same action.
+   *
+   * Note: 0 disables the reuse of workers
+   */
+  unsigned pool_size = 0;
+
+  /**
+   * Time an idle worker is kept alive before it will be destroyed
+   */
+  std::chrono::milliseconds keep_alive{ 10'000 };
+
+  /**
+   * Prepare a new worker process up to the start of the function after
+   * every invocation. These zygotes are kept in the worker pool and every
+   * invocation will use a fresh process.
+   *
+   * Note: This replaces the reuse of workers
+   */
+  bool zygote = false;
+
+  /**
+   * Keep one loaded but not yet started worker process per invoked action
+   * and client. It is loaded after the reply of an invocation was sent, the
+   * next invocation of the action only has to start its thread.
+   */
+  bool prelaunch = false;
+
+  /**
+   * Let idle client threads load the prelaunched workers of busy client
+   * threads.
+   *
+   * Note: Only has an effect in combination with prelaunch
+   */
+  Steal_policy steal = Steal_policy::NONE;
+
+  /**
+   * Number of spare stacks that are kept allocated per client. The stacks of
+   * finished workers are scrubbed and reused.
+   *
+   * Note: 0 disables the pool, the stacks are then allocated by every worker
+   */
+  unsigned stack_pool = 0;
+
+  /**
+   * Number of workers per client for which capability slots and region maps
+   * are kept ahead of time. This also limits the number of parent gates and
+   * slots of limited memory allocators that are kept for reuse.
+   *
+   * Note: 0 disables the pool
+   */
+  unsigned kobject_pool = 0;
+
+  /**
+   * Maximum number of client threads that are parked once their client left.
+   * A parked thread is bound to the next client that registers.
+   *
+   * Note: 0 disables the pool, the threads exit with their client
+   */
+  unsigned thread_pool = 0;
+
+  /**
+   * Number of threads that fill the pool of client threads with new threads,
+   * thus the registry thread doesn't have to create them.
+   *
+   * Note: Only has an effect in combination with thread_pool
+   */
+  unsigned spawn_threads = 0;
+
+  /**
+   * Cpus that share a last level cache, e.g. "0-3,4-7" for two caches with
+   * four cpus each (see Cpu_allocator::set_topology())
+   *
+   * Note: empty if the topology is unknown
+   */
+  std::string topology;
+};
+
+extern Options options;
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include "elf_image.h"
 #include "manager.h"
 
 #include <l4/mett-eagle/base>
@@ -37,8 +38,30 @@ struct Action
 {
   L4Re::Util::Shared_cap<L4Re::Dataspace> ds;
   MettEagle::Language lang;
+
+  /**
+   * The binary that is started by the workers. This is either the action
+   * itself or the runtime of its language.
+   */
+  L4Re::Util::Shared_cap<L4Re::Dataspace> bin;
+
+  /**
+   * The validated and attached binary, created once while creating the
+   * action
+   *
+   * shared with the workers that are still loading it
+   */
+  std::shared_ptr<Elf_image const> image;
+
+  /**
+   * Compiled version of the action, created once while creating the action
+   * (only used by python actions, invalid otherwise)
+   */
+  L4Re::Util::Shared_cap<L4Re::Dataspace> code;
 };
 
+class Worker_Pool;
+
 struct Manager_Base_Epiface : L4::Epiface_t0<MettEagle::Manager_Base>
 {
 protected:
@@ -53,6 +76,14 @@ protected:
    */
   std::shared_ptr<std::map<std::string, Action> > _actions;
 
+  /**
+   * @brief Per client pool of parked workers
+   *
+   * Like the _actions it is shared by the client epiface and the worker
+   * epifaces, thus nested invocations can also reuse parked workers.
+   */
+  std::shared_ptr<Worker_Pool> _pool;
+
   /**
    * @brief The client specific thread that will execute all actions
    *
@@ -7,10 +7,107 @@
  */
 
 #include "manager_client.h"
+#include "library_cache.h"
+#include "worker_pool.h"
+
+#include <l4/re/env>
+#include <l4/re/mem_alloc>
+#include <l4/re/rm>
+#include <l4/re/util/unique_cap>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/**
+ * Maximum time the runtime may need to compile an action
+ */
+static constexpr l4_uint32_t Compile_timeout_us = 5'000'000;
+
+/**
+ * Maximum number of asynchronous invocations per client whose results were
+ * not fetched yet
+ */
+static constexpr std::size_t Max_invocations = 64;
+
+/**
+ * @brief Start the worker of an asynchronous invocation
+ *
+ * The invocation is marked as done by the completion of the worker (or right
+ * away if it couldn't be started).
+ */
+static void
+start (Worker_Pool &pool, std::shared_ptr<Invocation> const &invocation)
+{
+  invocation->started = true;
+  try
+    {
+      invocation->run = pool.invoke_async (
+          invocation->name, invocation->argument, invocation->cfg,
+          [invocation] (long error, std::string const &value,
+                        MettEagle::Metadata const &data) {
+            invocation->done = true;
+            invocation->error = error;
+            invocation->value = value;
+            invocation->data = data;
+          });
+    }
+  catch (Loggable_exception &e)
+    {
+      log<ERROR> (e);
+      invocation->done = true;
+      invocation->error = e.err_no ();
+    }
+  catch (L4::Runtime_error &e)
+    {
+      log<ERROR> (e);
+      invocation->done = true;
+      invocation->error = e.err_no ();
+    }
+}
+
+/**
+ * @brief Compile the script of an action
+ *
+ * The runtime of the action is started with an initial capability 'compile'
+ * and will write the compiled script into this dataspace instead of executing
+ * it.
+ *
+ * @param pool    Pool used to create the compiling worker
+ * @param action  The action, its binary has to be set already
+ *
+ * @return  Dataspace containing the compiled script
+ *
+ * @throws Loggable_exception(-L4_EINVAL) in case the script couldn't be
+ *         compiled
+ */
+static L4Re::Util::Shared_cap<L4Re::Dataspace>
+compile_action (Worker_Pool &pool, Action const &action)
+{
+  /* the compiled script should not be larger than a multiple of the source */
+  auto code = chkcap (L4Re::Util::make_shared_cap<L4Re::Dataspace> (),
+                      "allocate code capability");
+  chksys (L4Re::Env::env ()->mem_alloc ()->alloc (
+              4 * action.ds->size () + 0x10000, code.get ()),
+          "allocate code dataspace");
+
+  auto handle = pool.create (action, 0, {});
+  handle->worker->add_initial_capability (
+      code.get (), "compile", L4_cap_fpage_rights::L4_CAP_FPAGE_RW);
+  handle->worker->launch ();
+  handle->run (Compile_timeout_us, std::chrono::high_resolution_clock::now (),
+               false);
+  if (L4_UNLIKELY (handle->worker->exited_with_error ()))
+    throw Loggable_exception (-L4_EINVAL, "Failed to compile the action");
+
+  return code;
+}
 
 Manager_Client_Epiface::Manager_Client_Epiface (
     L4::Cap<L4::Thread> thread,
-    L4Re::Util::Shared_cap<L4::Scheduler> scheduler)
+    L4Re::Util::Shared_cap<L4::Scheduler> scheduler,
+    l4_sched_cpu_set_t affinity, Client_server *server,
+    Cpu_allocator::Client cpus)
 {
   /* _actions map will be create by the clients epiface and only *
    * passed to each worker epiface.                              */
@@ -18,6 +115,17 @@ Manager_Client_Epiface::Manager_Client_Epiface (
 
   _thread = thread;
   _scheduler = scheduler;
+  _server = server;
+
+  /* same for the pool of parked workers */
+  _pool = std::make_shared<Worker_Pool> (_actions, _thread, _scheduler,
+                                         affinity, server, cpus);
+}
+
+Manager_Client_Epiface::~Manager_Client_Epiface ()
+{
+  /* destroy the parked workers of the leaving client */
+  _pool->clear ();
 }
 
 long
@@ -25,7 +133,9 @@ Manager_Client_Epiface::op_action_create (
     MettEagle::Manager_Client::Rights, const L4::Ipc::String_in_buf<> &_name,
     L4::Ipc::Snd_fpage file, MettEagle::Language lang)
 {
-  const char *name = _name.data;
+  /* copy the name, the utcb will be reused by the ipc calls that are
+   * necessary to load the binary */
+  const std::string name = _name.data;
   // log<DEBUG> ("Create action name='{:s}' file passed='{}'", name,
               // file.cap_received ());
 
@@ -39,11 +149,48 @@ Manager_Client_Epiface::op_action_create (
     throw Loggable_exception (-L4_EEXIST, "Action '{:s}' already exists",
                               name);
 
-  /* safe the received capability and language*/
-  (*_actions)[name] = { L4Re::Util::Shared_cap<L4Re::Dataspace> (cap), lang };
+  /* the received capability is owned by the action from here on */
+  Action action{ L4Re::Util::Shared_cap<L4Re::Dataspace> (cap), lang };
   if (L4_UNLIKELY (server_iface ()->realloc_rcv_cap (0) < 0))
     throw Loggable_exception (-L4_ENOMEM, "Failed to realloc_rcv_cap");
 
+  switch (lang)
+    {
+    case MettEagle::Language::BINARY:
+      /* in case the received dataspace already contains the binary, it is
+       * started directly */
+      action.bin = action.ds;
+      break;
+      /* if it need a runtime the correct one should be selected */
+    case MettEagle::Language::PYTHON:
+      {
+        /* the runtime is shared by all python actions */
+        auto runtime = library_cache.open ("rom/python-faas2.7");
+        if (L4_UNLIKELY (not runtime.image))
+          throw Loggable_exception (-L4_EINVAL,
+                                    "'rom/python-faas2.7' is no ELF binary");
+        action.bin = runtime.ds;
+        action.image = runtime.image;
+      }
+      break;
+    default:
+      throw Loggable_exception (-L4_EINVAL, "Unknown language");
+    }
+  /* parse the binary only once, this will also reject invalid binaries */
+  if (not action.image)
+    action.image = std::make_shared<Elf_image> (action.bin.get ());
+
+  /* compile the script once instead of on every invocation */
+  if (lang == MettEagle::Language::PYTHON)
+    action.code = compile_action (*_pool, action);
+
+  /* safe the received capability and language*/
+  (*_actions)[name] = action;
+
+  /* the first invocation should already find a zygote */
+  if (options.zygote)
+    _pool->prepare (name, 0);
+
   return L4_EOK;
 }
 
@@ -58,6 +205,265 @@ Manager_Client_Epiface::op_action_delete (
   /* this should decrease the ref count and unmap the dataspace in case no
    * worker is currently using it */
   _actions->erase (name);
+  /* parked workers would still execute the old action */
+  _pool->remove (name);
+
+  return L4_EOK;
+}
+
+long
+Manager_Client_Epiface::op_action_prewarm (
+    MettEagle::Manager_Client::Rights, const L4::Ipc::String_in_buf<> &_name,
+    l4_umword_t count, l4_mword_t memory_limit)
+{
+  const std::string name = _name.data;
+
+  if (L4_UNLIKELY (_actions->count (name) == 0))
+    throw Loggable_exception (-L4_EINVAL, "Action '{:s}' doesn't exist", name);
+  if (L4_UNLIKELY (options.pool_size == 0))
+    throw Loggable_exception (-L4_ENOSYS,
+                              "Prewarm without worker pool (see --pool-size)");
+
+  /* more workers wouldn't fit into the pool anyway */
+  count = std::min<l4_umword_t> (count, options.pool_size);
+  /* the workers are prepared one after the other once the reply was sent */
+  for (l4_umword_t i = 0; i < count; i++)
+    _pool->prepare (name, memory_limit);
+
+  return L4_EOK;
+}
+
+long
+Manager_Client_Epiface::op_action_invoke_async (
+    MettEagle::Manager_Client::Rights, const L4::Ipc::String_in_buf<> &_name,
+    const L4::Ipc::String_in_buf<> &arg, MettEagle::Config cfg,
+    l4_umword_t &ticket)
+{
+  auto invocation = std::make_shared<Invocation> ();
+  invocation->name = _name.data;
+  invocation->argument = arg.data;
+  invocation->cfg = cfg;
+
+  if (L4_UNLIKELY (_actions->count (invocation->name) == 0))
+    throw Loggable_exception (-L4_EINVAL, "Action '{:s}' doesn't exist",
+                              invocation->name);
+  if (L4_UNLIKELY (_invocations.size () >= Max_invocations))
+    throw Loggable_exception (-L4_EBUSY, "Too many outstanding invocations");
+
+  l4_umword_t id = _next_ticket++;
+  _invocations[id] = invocation;
+
+  /* the worker is started once the reply was sent -- unless the client
+   * waits for the invocation before */
+  Deferred::schedule (_server, _pool, [invocation] (Worker_Pool &pool) {
+    if (not invocation->started and not invocation->forgotten)
+      start (pool, invocation);
+  });
 
+  ticket = id;
   return L4_EOK;
-}
\ No newline at end of file
+}
+
+long
+Manager_Client_Epiface::reply_invocation (l4_umword_t ticket,
+                                          L4::Ipc::Array_ref<char> &ret,
+                                          MettEagle::Metadata &data)
+{
+  /* the result can only be fetched once */
+  auto invocation = std::move (_invocations.at (ticket));
+  _invocations.erase (ticket);
+
+  if (L4_UNLIKELY (invocation->error != L4_EOK))
+    throw Loggable_exception (invocation->error, "Invocation {:d} failed",
+                              ticket);
+  auto const &value = invocation->value;
+  if (L4_UNLIKELY (value.length () >= ret.length))
+    throw Loggable_exception (-L4_EMSGTOOLONG, "The utcb buffer is too small!");
+
+  /* set return values */
+  data = invocation->data;
+  memcpy (ret.data, value.c_str (), value.length () + 1);
+  ret.length = value.length () + 1;
+  return L4_EOK;
+}
+
+long
+Manager_Client_Epiface::op_action_poll (MettEagle::Manager_Client::Rights,
+                                        l4_umword_t ticket,
+                                        L4::Ipc::Array_ref<char> &ret,
+                                        MettEagle::Metadata &data)
+{
+  auto entry = _invocations.find (ticket);
+  if (L4_UNLIKELY (entry == _invocations.end ()))
+    throw Loggable_exception (-L4_ENOENT, "Unknown ticket {:d}", ticket);
+  if (not entry->second->done)
+    return -L4_EAGAIN;
+
+  return reply_invocation (ticket, ret, data);
+}
+
+long
+Manager_Client_Epiface::op_action_wait (MettEagle::Manager_Client::Rights,
+                                        l4_umword_t ticket,
+                                        L4::Ipc::Array_ref<char> &ret,
+                                        MettEagle::Metadata &data)
+{
+  auto entry = _invocations.find (ticket);
+  if (L4_UNLIKELY (entry == _invocations.end ()))
+    throw Loggable_exception (-L4_ENOENT, "Unknown ticket {:d}", ticket);
+  auto invocation = entry->second;
+  /* the thread is not able to wait for its own deferred work, thus the
+   * start of the invocation is pulled forward */
+  if (not invocation->started)
+    start (*_pool, invocation);
+  if (auto run = invocation->run.lock ())
+    _pool->wait (run);
+  if (L4_UNLIKELY (not invocation->done))
+    throw Loggable_exception (-L4_EFAULT, "Invocation {:d} was lost", ticket);
+
+  return reply_invocation (ticket, ret, data);
+}
+
+long
+Manager_Client_Epiface::op_action_invoke_batch (
+    MettEagle::Manager_Client::Rights, L4::Ipc::Snd_fpage batch,
+    l4_umword_t count)
+{
+  if (L4_UNLIKELY (not batch.cap_received ()))
+    throw Loggable_exception (-L4_EINVAL, "No dataspace cap received");
+  /* the received capability is only needed during this call */
+  L4Re::Util::Unique_cap<L4Re::Dataspace> ds (
+      server_iface ()->rcv_cap<L4Re::Dataspace> (0));
+  if (L4_UNLIKELY (server_iface ()->realloc_rcv_cap (0) < 0))
+    throw Loggable_exception (-L4_ENOMEM, "Failed to realloc_rcv_cap");
+
+  if (L4_UNLIKELY (not ds.validate ().label ()))
+    throw Loggable_exception (-L4_EINVAL, "Received capability is invalid");
+  auto record
+      = sizeof (MettEagle::Batch_request) + sizeof (MettEagle::Batch_result);
+  if (L4_UNLIKELY (count == 0 or count > ds->size () / record))
+    throw Loggable_exception (-L4_EINVAL, "Batch dataspace too small");
+
+  L4Re::Rm::Unique_region<char *> region;
+  chksys (L4Re::Env::env ()->rm ()->attach (
+              &region, l4_round_page (count * record),
+              L4Re::Rm::F::Search_addr | L4Re::Rm::F::RW,
+              L4::Ipc::make_cap_rw (ds.get ()), 0),
+          "attach batch");
+  auto requests = reinterpret_cast<MettEagle::Batch_request *> (region.get ());
+  auto results = reinterpret_cast<MettEagle::Batch_result *> (requests + count);
+
+  /* the workers run in parallel as far as the cpus of the client allow,
+   * further ones are started once the oldest one finished. Thereby a large
+   * batch doesn't create all of its processes at once. */
+  l4_umword_t window = std::max (1U, _pool->cpu_count ());
+  std::vector<std::shared_ptr<Invocation> > invocations (count);
+  auto begin = [&] (l4_umword_t i) {
+    /* the client might modify the records at any time */
+    auto const &request = requests[i];
+    auto invocation = std::make_shared<Invocation> ();
+    invocation->name.assign (request.name,
+                             strnlen (request.name, sizeof (request.name)));
+    invocation->argument.assign (request.arg,
+                                 strnlen (request.arg, sizeof (request.arg)));
+    invocation->cfg = request.cfg;
+    start (*_pool, invocation);
+    invocations[i] = invocation;
+  };
+
+  l4_umword_t started = 0;
+  for (; started < count and started < window; started++)
+    begin (started);
+
+  for (l4_umword_t i = 0; i < count; i++)
+    {
+      auto invocation = std::move (invocations[i]);
+      if (auto run = invocation->run.lock ())
+        _pool->wait (run);
+      if (started < count)
+        begin (started++);
+
+      auto &result = results[i];
+      result.status = invocation->error;
+      if (L4_UNLIKELY (not invocation->done))
+        result.status = -L4_EFAULT;
+      else if (L4_UNLIKELY (invocation->value.length () >= sizeof (result.ret)))
+        result.status = -L4_EMSGTOOLONG;
+      if (result.status != L4_EOK)
+        continue;
+      memcpy (result.ret, invocation->value.c_str (),
+              invocation->value.length () + 1);
+      result.data = invocation->data;
+    }
+
+  return L4_EOK;
+}
+
+long
+Manager_Client_Epiface::op_action_invoke_ds (
+    MettEagle::Manager_Client::Rights, const L4::Ipc::String_in_buf<> &_name,
+    const L4::Ipc::String_in_buf<> &_arg, L4::Ipc::Snd_fpage arg,
+    l4_umword_t arg_size, L4::Ipc::Snd_fpage result,
+    L4::Ipc::Array_ref<char> &ret, MettEagle::Config _cfg,
+    l4_umword_t &result_size, MettEagle::Metadata &data)
+{
+  /* copy the values, the utcb is reused by the ipc of the worker */
+  const std::string name = _name.data;
+  const std::string argument = _arg.data;
+  MettEagle::Config cfg = _cfg;
+
+  if (L4_UNLIKELY (not arg.cap_received () or not result.cap_received ()))
+    throw Loggable_exception (-L4_EINVAL, "No dataspace caps received");
+  /* the received capabilities are only needed during this call, their
+   * deletion also revokes the mappings of the worker */
+  L4Re::Util::Unique_cap<L4Re::Dataspace> arg_ds (
+      server_iface ()->rcv_cap<L4Re::Dataspace> (0));
+  L4Re::Util::Unique_cap<L4Re::Dataspace> result_ds (
+      server_iface ()->rcv_cap<L4Re::Dataspace> (1));
+  if (L4_UNLIKELY (server_iface ()->realloc_rcv_cap (0) < 0
+                   or server_iface ()->realloc_rcv_cap (1) < 0))
+    throw Loggable_exception (-L4_ENOMEM, "Failed to realloc_rcv_cap");
+
+  if (L4_UNLIKELY (not arg_ds.validate ().label ()
+                   or not result_ds.validate ().label ()))
+    throw Loggable_exception (-L4_EINVAL, "Received capability is invalid");
+  if (L4_UNLIKELY (arg_size > arg_ds->size ()))
+    throw Loggable_exception (-L4_EINVAL, "Argument dataspace too small");
+  auto result_capacity = result_ds->size ();
+
+  /* the worker queries the size of the argument on its own */
+  MettEagle::Metadata meta_data;
+  Payload payload{ arg_ds.get (), arg_size, result_ds.get () };
+  std::string exit_value
+      = _pool->invoke (name, argument, cfg, meta_data, &payload);
+
+  if (L4_UNLIKELY (meta_data.result_length > result_capacity))
+    throw Loggable_exception (-L4_EMSGTOOLONG, "Result dataspace too small");
+  if (L4_UNLIKELY (exit_value.length () >= ret.length))
+    throw Loggable_exception (-L4_EMSGTOOLONG, "The utcb buffer is too small!");
+
+  /* unmapping the capabilities is a syscall, see op_action_invoke() */
+  arg_ds.reset ();
+  result_ds.reset ();
+
+  /* set return values */
+  data = meta_data;
+  result_size = meta_data.result_length;
+  memcpy (ret.data, exit_value.c_str (), exit_value.length () + 1);
+  ret.length = exit_value.length () + 1;
+  return L4_EOK;
+}
+
+long
+Manager_Client_Epiface::op_action_forget (MettEagle::Manager_Client::Rights,
+                                          l4_umword_t ticket)
+{
+  auto entry = _invocations.find (ticket);
+  if (L4_UNLIKELY (entry == _invocations.end ()))
+    throw Loggable_exception (-L4_ENOENT, "Unknown ticket {:d}", ticket);
+
+  /* a running worker keeps the invocation until it is finished */
+  entry->second->forgotten = true;
+  _invocations.erase (entry);
+  return L4_EOK;
+}
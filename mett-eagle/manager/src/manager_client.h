@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include "cpu_allocator.h"
 #include "manager.h"
 #include "manager_base.h"
 
@@ -25,13 +26,64 @@
 #include <l4/sys/scheduler>
 #include <l4/sys/thread>
 
+#include <map>
+#include <memory>
+#include <string>
+
+struct Async_run;
+
+/**
+ * @brief State of an asynchronous or batched invocation (see
+ * MettEagle::Manager_Client::action_invoke_async())
+ */
+struct Invocation
+{
+  std::string name;
+  std::string argument;
+  MettEagle::Config cfg;
+
+  /** worker of the invocation, set once it was started */
+  std::weak_ptr<Async_run> run;
+  bool started = false;
+
+  /** set once the client dropped the ticket, it is not started anymore */
+  bool forgotten = false;
+
+  /** set once the invocation was executed */
+  bool done = false;
+  /** L4_EOK or the error code the invocation failed with */
+  long error = L4_EOK;
+  std::string value;
+  MettEagle::Metadata data;
+};
+
 struct Manager_Client_Epiface
     : L4::Epiface_t<Manager_Client_Epiface, MettEagle::Manager_Client,
                     Manager_Base_Epiface>
 {
+private:
+  /** server loop of the client thread, used to defer the invocations */
+  Client_server *_server;
+
+  /** asynchronous invocations whose results were not fetched yet */
+  std::map<l4_umword_t, std::shared_ptr<Invocation> > _invocations;
+
+  l4_umword_t _next_ticket = 1;
+
+  long reply_invocation (l4_umword_t ticket, L4::Ipc::Array_ref<char> &ret,
+                         MettEagle::Metadata &data);
+
 public:
+  /**
+   * @param affinity  Cpus of the client, threads have to be run with it on
+   *                  the scheduler (see Cpu_allocator::scheduler())
+   */
   Manager_Client_Epiface (L4::Cap<L4::Thread> thread,
-                          L4Re::Util::Shared_cap<L4::Scheduler> scheduler);
+                          L4Re::Util::Shared_cap<L4::Scheduler> scheduler,
+                          l4_sched_cpu_set_t affinity, Client_server *server,
+                          Cpu_allocator::Client cpus);
+
+  ~Manager_Client_Epiface ();
 
   long op_action_create (MettEagle::Manager_Client::Rights,
                          const L4::Ipc::String_in_buf<> &_name,
@@ -40,4 +92,36 @@ public:
 
   long op_action_delete (MettEagle::Manager_Client::Rights,
                          const L4::Ipc::String_in_buf<> &_name);
+
+  long op_action_prewarm (MettEagle::Manager_Client::Rights,
+                          const L4::Ipc::String_in_buf<> &_name,
+                          l4_umword_t count, l4_mword_t memory_limit);
+
+  long op_action_invoke_async (MettEagle::Manager_Client::Rights,
+                               const L4::Ipc::String_in_buf<> &_name,
+                               const L4::Ipc::String_in_buf<> &arg,
+                               MettEagle::Config cfg, l4_umword_t &ticket);
+
+  long op_action_poll (MettEagle::Manager_Client::Rights, l4_umword_t ticket,
+                       L4::Ipc::Array_ref<char> &ret,
+                       MettEagle::Metadata &data);
+
+  long op_action_wait (MettEagle::Manager_Client::Rights, l4_umword_t ticket,
+                       L4::Ipc::Array_ref<char> &ret,
+                       MettEagle::Metadata &data);
+
+  long op_action_invoke_batch (MettEagle::Manager_Client::Rights,
+                               L4::Ipc::Snd_fpage batch, l4_umword_t count);
+
+  long op_action_invoke_ds (MettEagle::Manager_Client::Rights,
+                            const L4::Ipc::String_in_buf<> &_name,
+                            const L4::Ipc::String_in_buf<> &_arg,
+                            L4::Ipc::Snd_fpage arg, l4_umword_t arg_size,
+                            L4::Ipc::Snd_fpage result,
+                            L4::Ipc::Array_ref<char> &ret,
+                            MettEagle::Config cfg, l4_umword_t &result_size,
+                            MettEagle::Metadata &data);
+
+  long op_action_forget (MettEagle::Manager_Client::Rights,
+                         l4_umword_t ticket);
 };
\ No newline at end of file
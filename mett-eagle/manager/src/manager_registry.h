@@ -26,6 +26,7 @@ struct Manager_Registry_Epiface
                     L4Re::MettEagle::Manager_Registry>
 {
   long op_register_client (
-      L4Re::MettEagle::Manager_Registry::Rights,
+      L4Re::MettEagle::Manager_Registry::Rights, l4_umword_t min_cores,
+      l4_umword_t max_cores,
       L4::Ipc::Cap<L4Re::MettEagle::Manager_Client> &manager_ipc_gate);
 };
\ No newline at end of file
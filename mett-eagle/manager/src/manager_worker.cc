@@ -10,12 +10,13 @@
 
 Manager_Worker_Epiface::Manager_Worker_Epiface (
     std::shared_ptr<std::map<std::string, Action> > actions,
-    L4::Cap<L4::Thread> thread,
+    std::shared_ptr<Worker_Pool> pool, L4::Cap<L4::Thread> thread,
     L4Re::Util::Shared_cap<L4::Scheduler> scheduler,
     std::shared_ptr<Worker> worker)
 {
-  /* passed actions map from the client */
+  /* passed actions map and worker pool from the client */
   _actions = actions;
+  _pool = pool;
   _thread = thread;
   _scheduler = scheduler;
   _worker = worker;
@@ -39,6 +40,7 @@ Manager_Worker_Epiface::op_signal (L4Re::Parent::Rights, unsigned long sig,
 
       /* using exit(int) to indicate unusual exit */
       _worker->exit (err);
+      done ();
 
       /* do not send answer -- child shouldn't exist anymore */
       return -L4_ENOREPLY;
@@ -61,8 +63,67 @@ Manager_Worker_Epiface::op_exit (MettEagle::Manager_Worker::Rights,
   // log<DEBUG> ("Worker exit: {:s}", value);
   _worker->exit (value);
   _metadata = data;
+  done ();
 
   /* With -L4_ENOREPLY no answer will be send to the worker. Keep the worker
    * thread blocked until destroyed. */
   return -L4_ENOREPLY;
 }
+
+long
+Manager_Worker_Epiface::op_next_invocation (
+    MettEagle::Manager_Worker::Rights, const L4::Ipc::String_in_buf<> &_value,
+    MettEagle::Worker_Metadata data)
+{
+  const char *value = _value.data;
+
+  _worker->park (value);
+  _metadata = data;
+  done ();
+
+  /* The worker stays blocked until the reply is sent on its next invocation.
+   * In case the worker isn't reused it will just be destroyed. */
+  return -L4_ENOREPLY;
+}
+
+long
+Manager_Worker_Epiface::op_ready (MettEagle::Manager_Worker::Rights)
+{
+  /* a prelaunched worker might already have been resumed before it was
+   * started, it can fetch its argument right away */
+  if (_worker->resumed ())
+    return L4_EOK;
+
+  /* a zygote has no result yet */
+  _worker->park ("");
+  done ();
+
+  /* The reply will be sent on the first invocation of the zygote */
+  return -L4_ENOREPLY;
+}
+
+long
+Manager_Worker_Epiface::op_argument (MettEagle::Manager_Worker::Rights,
+                                     L4::Ipc::Array_ref<char> &arg)
+{
+  auto const &value = _worker->argument ();
+
+  /* check if utcb buffer is large enough */
+  if (L4_UNLIKELY (value.length () >= arg.length))
+    throw Loggable_exception (-L4_EMSGTOOLONG,
+                              "The utcb buffer is too small!");
+
+  memcpy (arg.data, value.c_str (), value.length () + 1);
+  arg.length = value.length () + 1;
+  return L4_EOK;
+}
+
+long
+Manager_Worker_Epiface::op_payload (MettEagle::Manager_Worker::Rights,
+                                    l4_umword_t &arg_size)
+{
+  if (not _worker->payload ())
+    return -L4_ENOENT;
+  arg_size = _worker->payload_size ();
+  return L4_EOK;
+}
@@ -27,6 +27,7 @@
 #include <l4/sys/thread>
 
 #include <chrono>
+#include <functional>
 
 struct Manager_Worker_Epiface
     : L4::Epiface_t<Manager_Worker_Epiface, MettEagle::Manager_Worker,
@@ -38,14 +39,48 @@ protected:
 
 public:
   MettEagle::Worker_Metadata _metadata;
-  
+
+  /**
+   * Called once the worker exited or parked, only set while the worker runs
+   * without a closed wait (see Worker_Pool::invoke_async())
+   */
+  std::function<void (void)> _on_done;
+
 public:
   Manager_Worker_Epiface (
       std::shared_ptr<std::map<std::string, Action> > actions,
-      L4::Cap<L4::Thread> thread,
+      std::shared_ptr<Worker_Pool> pool, L4::Cap<L4::Thread> thread,
       L4Re::Util::Shared_cap<L4::Scheduler> scheduler,
       std::shared_ptr<Worker> worker);
 
+  /**
+   * @brief Bind the epiface to another worker
+   *
+   * This is used to reuse the epiface (and its ipc gate) once the previous
+   * worker is destroyed.
+   */
+  void
+  rebind (std::shared_ptr<Worker> worker)
+  {
+    _worker = worker;
+    _metadata = {};
+    _on_done = nullptr;
+  }
+
+  /**
+   * @brief Notify the waiting invocation that the worker exited or parked
+   */
+  void
+  done ()
+  {
+    if (not _on_done)
+      return;
+    /* the function might reset _on_done itself */
+    auto on_done = std::move (_on_done);
+    _on_done = nullptr;
+    on_done ();
+  }
+
   /**
    * Implementation of the signal method from the L4Re::Parent interface.
    *
@@ -65,4 +100,15 @@ public:
   long op_exit (MettEagle::Manager_Worker::Rights,
                 const L4::Ipc::String_in_buf<> &_value,
                 MettEagle::Worker_Metadata data);
+
+  long op_next_invocation (MettEagle::Manager_Worker::Rights,
+                           const L4::Ipc::String_in_buf<> &_value,
+                           MettEagle::Worker_Metadata data);
+
+  long op_ready (MettEagle::Manager_Worker::Rights);
+
+  long op_argument (MettEagle::Manager_Worker::Rights,
+                    L4::Ipc::Array_ref<char> &arg);
+
+  long op_payload (MettEagle::Manager_Worker::Rights, l4_umword_t &arg_size);
 };
@@ -25,3 +25,12 @@ Stack::set_stack (L4Re::Util::Shared_cap<L4Re::Dataspace> const &ds,
   _stack_ds = ds;
   set_local_top ((char *)(_vma.get () + size));
 }
+
+void
+Stack::set_stack (L4Re::Util::Shared_cap<L4Re::Dataspace> const &ds,
+                  char *local, unsigned size)
+{
+  _stack_ds = ds;
+  _populated = true;
+  set_local_top (local + size);
+}
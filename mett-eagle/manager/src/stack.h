@@ -32,11 +32,16 @@ protected:
 
   l4_addr_t _last_checked;
 
+  /* set if all pages of the stack are already allocated */
+  bool _populated = false;
+
   Stack_base () : _last_checked (0) {}
 
   void
   check_access (char *addr, size_t sz)
   {
+    if (_populated)
+      return;
     if (_last_checked != l4_trunc_page (l4_addr_t (addr)))
       {
         l4_addr_t offs = l4_trunc_page (addr - _vma.get ());
@@ -52,4 +57,14 @@ class Stack : public Ldr::Remote_stack<Stack_base>
 public:
   explicit Stack () : Ldr::Remote_stack<Stack_base> (0) {}
   void set_stack (Stack_base::Dataspace const &ds, unsigned size);
+
+  /**
+   * @brief Use a stack that is already attached and populated
+   *
+   * @param ds     The dataspace of the stack
+   * @param local  Local address the dataspace is attached to
+   * @param size   Size of the stack
+   */
+  void set_stack (Stack_base::Dataspace const &ds, char *local,
+                  unsigned size);
 };
@@ -0,0 +1,75 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "stack_pool.h"
+
+#include <l4/re/env>
+#include <l4/re/mem_alloc>
+
+#include <cstring>
+
+std::shared_ptr<Stack_pool::Entry>
+Stack_pool::allocate (unsigned size)
+{
+  auto entry = std::make_shared<Entry> ();
+  entry->size = size;
+  entry->ds = chkcap (L4Re::Util::make_shared_cap<L4Re::Dataspace> (),
+                      "allocate stack capability");
+  chksys (L4Re::Env::env ()->mem_alloc ()->alloc (size, entry->ds.get ()),
+          "allocate stack");
+  chksys (L4Re::Env::env ()->rm ()->attach (
+              &entry->region, size, L4Re::Rm::F::Search_addr | L4Re::Rm::F::RW,
+              L4::Ipc::make_cap_rw (entry->ds.get ()), 0),
+          "attaching stack vma");
+  /* touch every page, the stack will then be populated completely */
+  memset (entry->region.get (), 0, size);
+  return entry;
+}
+
+unsigned
+Stack_pool::count (unsigned size) const
+{
+  unsigned count = 0;
+  for (auto const &entry : _free)
+    if (entry->size == size)
+      count++;
+  return count;
+}
+
+std::shared_ptr<Stack_pool::Entry>
+Stack_pool::take (unsigned size)
+{
+  Deferred::schedule (_server, shared_from_this (), [size] (Stack_pool &pool) {
+    for (auto free = pool.count (size); free < options.stack_pool; free++)
+      pool._free.push_back (allocate (size));
+  });
+
+  for (auto it = _free.begin (); it != _free.end (); it++)
+    if ((*it)->size == size)
+      {
+        auto entry = *it;
+        _free.erase (it);
+        return entry;
+      }
+  /* pool is empty -- allocate one on the critical path */
+  return allocate (size);
+}
+
+void
+Stack_pool::put (std::shared_ptr<Entry> entry)
+{
+  Deferred::schedule (_server, shared_from_this (),
+                      [entry] (Stack_pool &pool) {
+                        if (pool.count (entry->size) >= options.stack_pool)
+                          return;
+                        /* the next worker must not see anything of the
+                         * previous one */
+                        memset (entry->region.get (), 0, entry->size);
+                        pool._free.push_back (entry);
+                      });
+}
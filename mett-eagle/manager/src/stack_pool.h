@@ -0,0 +1,100 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * Recycling of worker stacks
+ *
+ * Every client has a pool of stack dataspaces. These are allocated, attached
+ * to the manager and populated ahead of time. After the worker process using a
+ * stack is gone, the stack is scrubbed and put back into the pool.
+ */
+
+#pragma once
+
+#include "deferred.h"
+#include "manager.h"
+
+#include <l4/re/dataspace>
+#include <l4/re/rm>
+#include <l4/re/util/shared_cap>
+
+#include <list>
+#include <memory>
+
+class Stack_pool : public std::enable_shared_from_this<Stack_pool>
+{
+public:
+  struct Entry
+  {
+    L4Re::Util::Shared_cap<L4Re::Dataspace> ds;
+    /* local mapping of the stack */
+    L4Re::Rm::Unique_region<char *> region;
+    unsigned size;
+  };
+
+  /**
+   * @brief Stack that is currently used by a worker
+   *
+   * The stack is returned to the pool once the lease is destroyed. Thus it
+   * has to be destroyed after the task of the worker.
+   */
+  class Lease
+  {
+  private:
+    std::shared_ptr<Stack_pool> _pool;
+    std::shared_ptr<Entry> _entry;
+
+  public:
+    Lease () = default;
+    Lease (std::shared_ptr<Stack_pool> pool, std::shared_ptr<Entry> entry)
+        : _pool (pool), _entry (entry)
+    {
+    }
+    Lease (Lease const &) = delete;
+    Lease &operator= (Lease const &) = delete;
+    Lease &operator= (Lease &&) = default;
+
+    ~Lease ()
+    {
+      if (_entry)
+        _pool->put (_entry);
+    }
+  };
+
+private:
+  /** server loop of the client thread, used to defer work */
+  Client_server *_server;
+
+  /** scrubbed stacks that are ready to be used */
+  std::list<std::shared_ptr<Entry> > _free;
+
+  static std::shared_ptr<Entry> allocate (unsigned size);
+
+  unsigned count (unsigned size) const;
+
+public:
+  explicit Stack_pool (Client_server *server) : _server (server) {}
+
+  /**
+   * @brief Take a stack out of the pool
+   *
+   * In case the pool has no stack of the requested size a new one is
+   * allocated. The pool will be refilled once the current reply was sent.
+   *
+   * @param size  Size of the stack in bytes
+   */
+  std::shared_ptr<Entry> take (unsigned size);
+
+  /**
+   * @brief Scrub a stack and put it back into the pool
+   *
+   * This is deferred until the current reply was sent. Note: The stack must
+   * no longer be mapped to any worker.
+   */
+  void put (std::shared_ptr<Entry> entry);
+};
@@ -12,10 +12,12 @@
 #include <l4/re/util/cap>
 #include <l4/re/util/cap_alloc>
 #include <list>
+#include <memory>
 #include <string>
 #include <utility>
 
 #include <l4/liblog/log>
+#include <l4/liblog/loggable-exception>
 
 /**
  * App model that is really used in the end to start the worker process
@@ -38,6 +40,8 @@ private:
     std::string name;
     unsigned rights = 0;
     unsigned flags = 0;
+    /** slot of the capability in the process, set once it was launched */
+    l4_cap_idx_t index = L4_INVALID_CAP;
   };
 
   std::list<std::string> _argv;
@@ -53,15 +57,51 @@ private:
   int _exit_error;
   bool _error_exit = false;
 
+  /**
+   * This value will be set once the process handed over its result but is
+   * still able to handle further invocations (see ::park())
+   */
+  bool _parked = false;
+  /** argument of the invocation the process was resumed with */
+  std::string _argument;
+  /**
+   * Set once the process got resumed but didn't hand over a result yet
+   * (see ::resume())
+   */
+  bool _resumed = false;
+
+  /** set while the invocation has an argument and a result dataspace */
+  bool _payload = false;
+  /** size of the argument in the argument dataspace */
+  l4_umword_t _payload_size = 0;
+
   Const_dataspace _bin;
 
+  Initial_Cap &
+  initial_capability (std::string const &name)
+  {
+    for (auto &init_cap : _initial_capabilities)
+      if (init_cap.name == name)
+        return init_cap;
+    throw L4Re::LibLog::Loggable_exception (
+        -L4_ENOENT, "No initial capability '{:s}'", name);
+  }
+
 public:
+  /**
+   * @param bin    The binary that will be started
+   * @param image  Parsed version of the binary (see Elf_image)
+   * @param kobjects  Pool of kernel objects (see Kobject_pool)
+   */
   explicit Worker (Const_dataspace bin,
+                   std::shared_ptr<Elf_image const> image,
                    L4::Cap<MettEagle::Manager_Worker> const &parent,
                    L4::Cap<L4::Scheduler> const &scheduler,
-                   L4::Cap<L4::Factory> const &alloc)
-      : Remote_app_model (parent, scheduler, alloc), _bin (bin)
+                   L4::Cap<L4::Factory> const &alloc,
+                   std::shared_ptr<Kobject_pool> kobjects = nullptr)
+      : Remote_app_model (parent, scheduler, alloc, kobjects), _bin (bin)
   {
+    _image = image;
   }
 
   /**
@@ -99,6 +139,96 @@ public:
     return _error_exit;
   }
 
+  /**
+   * @brief Stop the current invocation but keep the process alive
+   *
+   * The process handed over the result of its invocation and is now blocked
+   * until it gets resumed with the next invocation.
+   *
+   * @param value  This string should hold the exit value of the invocation
+   */
+  void
+  park (std::string value)
+  {
+    _exit_value = value;
+    _alive = false;
+    _parked = true;
+    _resumed = false;
+  }
+
+  /**
+   * Used to check if the worker process is able to handle another invocation
+   */
+  bool
+  parked () const
+  {
+    return _parked;
+  }
+
+  /**
+   * @brief Continue a parked process with the next invocation
+   *
+   * Note: This will only update the state, it is up to the caller to actually
+   * send the reply that wakes up the process.
+   *
+   * @param argument  The argument of the new invocation
+   */
+  void
+  resume (std::string argument)
+  {
+    _argument = argument;
+    _exit_value.clear ();
+    _alive = true;
+    _parked = false;
+    _resumed = true;
+  }
+
+  /**
+   * @brief Mark that the invocation passes dataspaces (see
+   * ::map_capability())
+   *
+   * @param payload   Set if the dataspaces are mapped
+   * @param arg_size  Size of the argument in its dataspace
+   */
+  void
+  set_payload (bool payload, l4_umword_t arg_size = 0)
+  {
+    _payload = payload;
+    _payload_size = arg_size;
+  }
+
+  bool
+  payload () const
+  {
+    return _payload;
+  }
+
+  l4_umword_t
+  payload_size () const
+  {
+    return _payload_size;
+  }
+
+  /**
+   * Used to check if the process already has an invocation to handle. This
+   * is the case if a process was resumed before it was started (see
+   * ::prelaunch()).
+   */
+  bool
+  resumed () const
+  {
+    return _resumed;
+  }
+
+  /**
+   * @brief Get the argument the process was resumed with
+   */
+  std::string const &
+  argument () const
+  {
+    return _argument;
+  }
+
   /**
    * @brief Get the exit value
    */
@@ -126,11 +256,12 @@ public:
   l4_cap_idx_t
   push_initial_caps (l4_cap_idx_t start)
   {
-    for (auto init_cap : _initial_capabilities)
+    for (auto &init_cap : _initial_capabilities)
       {
         auto name = init_cap.name.c_str ();
-        _stack.push (l4re_env_cap_entry_t (
-            name, get_initial_cap (name, &start), init_cap.flags));
+        init_cap.index = get_initial_cap (name, &start);
+        _stack.push (l4re_env_cap_entry_t (name, init_cap.index,
+                                           init_cap.flags));
       }
     return start;
   }
@@ -145,12 +276,15 @@ public:
   {
     for (auto init_cap : _initial_capabilities)
       {
+        /* the slot is reserved anyway, see ::map_capability() */
+        auto index = get_initial_cap (init_cap.name.c_str (), &start);
+        if (not init_cap.capability.is_valid ())
+          continue;
         L4Re::chksys (task->map (
             L4Re::This_task,
             init_cap.capability.fpage (
                 L4_cap_fpage_rights (init_cap.rights & 0xf)),
-            L4::Cap<void> (get_initial_cap (init_cap.name.c_str (), &start))
-                .snd_base ()));
+            L4::Cap<void> (index).snd_base ()));
       }
   }
 
@@ -301,8 +435,59 @@ public:
     _initial_capabilities.push_back ({ cap, name, rights, flags });
   }
 
+  /**
+   * @brief Map a capability into the slot of an initial capability
+   *
+   * The initial capability has to be added before the process was launched,
+   * possibly with an invalid capability to only reserve its slot. If the
+   * process wasn't launched yet, the capability is mapped on launch.
+   *
+   * @param name  Name of the initial capability
+   * @param cap   The capability that should be mapped, with the rights of the
+   *              initial capability
+   *
+   * @throws Loggable_exception(-L4_ENOENT) if there is no such initial
+   *         capability
+   */
+  void
+  map_capability (std::string const &name, L4::Cap<void> cap)
+  {
+    auto &init_cap = initial_capability (name);
+    init_cap.capability = cap;
+    if (init_cap.index == L4_INVALID_CAP)
+      return;
+    L4Re::chksys (
+        _task->map (L4Re::This_task,
+                    cap.fpage (L4_cap_fpage_rights (init_cap.rights & 0xf)),
+                    L4::Cap<void> (init_cap.index).snd_base ()),
+        "map capability into worker");
+  }
+
+  /**
+   * @brief Revoke a capability mapped with ::map_capability()
+   *
+   * The slot stays reserved for the next capability.
+   */
+  void
+  unmap_capability (std::string const &name)
+  {
+    auto &init_cap = initial_capability (name);
+    init_cap.capability = L4::Cap<void>::Invalid;
+    if (init_cap.index == L4_INVALID_CAP)
+      return;
+    L4Re::chksys (_task->unmap (L4::Cap<void> (init_cap.index).fpage (),
+                                L4_FP_ALL_SPACES),
+                  "unmap capability from worker");
+  }
+
   /**
    * Creates an Ldr::Elf_loader and uses it to start this new process
+   *
+   * The loader reads the headers from the already attached image.
+   *
+   * Note: Ldr::Elf_loader has no way to take a segment layout from outside,
+   * thus the headers are still parsed by every launch. Only the validation
+   * and the attachment of the binary happen once (see Elf_image).
    */
   void
   launch ()
@@ -310,6 +495,28 @@ public:
     // Mask of 0 will silence everything
     L4Re::Util::Dbg dbg (0, "Mett-Eagle", "ldr");
     Ldr::Elf_loader<Worker, L4Re::Util::Dbg> loader;
-    loader.launch (this, _bin, dbg);
+    try
+      {
+        loader.launch (this, _bin, dbg);
+      }
+    catch (...)
+      {
+        /* a cached library might have been rebound or revoked */
+        library_cache.invalidate ();
+        throw;
+      }
+  }
+
+  /**
+   * @brief Load the process without starting it
+   *
+   * All segments, libraries and the stack are set up, but the thread will
+   * only run once App_model::start_thread() is called.
+   */
+  void
+  prelaunch ()
+  {
+    _defer_start = true;
+    launch ();
   }
 };
\ No newline at end of file
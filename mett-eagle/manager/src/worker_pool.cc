@@ -0,0 +1,836 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+
+#include "worker_pool.h"
+
+#include <l4/re/env>
+#include <l4/sys/cxx/ipc_server_loop>
+
+#include <l4/sys/debugger.h>
+
+#include <algorithm>
+
+l4_timeout_s
+static check_timeout (
+    std::chrono::time_point<std::chrono::high_resolution_clock> start,
+    l4_uint32_t timeout_us)
+{
+  auto passed_us = std::chrono::duration_cast<std::chrono::microseconds> (
+                       std::chrono::high_resolution_clock::now () - start)
+                       .count ();
+  auto remaining_us = timeout_us - passed_us;
+  if (L4_UNLIKELY (remaining_us < 0))
+    throw Loggable_exception (-L4_EFAULT, "Worker timeout");
+  return l4_timeout_from_us (remaining_us);
+}
+
+/**
+ * Maximum number of workers waiting for their teardown
+ */
+static constexpr unsigned Retire_backlog = 8;
+
+/**
+ * Maximum time a zygote may need to complete its runtime setup
+ */
+static constexpr l4_uint32_t Zygote_timeout_us = 5'000'000;
+
+void
+Worker_Handle::run (
+    l4_uint32_t timeout_us,
+    std::chrono::time_point<std::chrono::high_resolution_clock> start,
+    bool resume)
+{
+  /**
+   * ========================== Server loop ==========================
+   *
+   * The following code implements a simple server loop. This loop has
+   * no demand allocation (-> can't receive capabilities) and will only
+   * dispatch to a single Epiface object.
+   * Nonetheless this loop is necessary to receive from and reply to a
+   * specific capability. In order to keep the reply capability of the
+   * client unchanged.
+   */
+
+  l4_timeout_t timeout = l4_timeout (L4_IPC_TIMEOUT_0, L4_IPC_TIMEOUT_NEVER);
+  if (timeout_us)
+    timeout.p.rcv = check_timeout (start, timeout_us);
+  l4_msgtag_t msg;
+  if (resume)
+    /* a parked worker is still waiting for the answer to its
+     * next_invocation call -- an empty reply will wake it up */
+    msg = chkipc (l4_ipc_call (worker->_thread.cap (), l4_utcb (),
+                               l4_msgtag (L4_EOK, 0, 0, 0), timeout),
+                  "Worker ipc failed.");
+  else
+    msg = chkipc (
+        l4_ipc_receive (worker->_thread.cap (), l4_utcb (), timeout),
+        "Worker ipc failed.");
+  while (true)
+    {
+      /* call the corresponding function of the epiface */
+      l4_msgtag_t reply = gate->epiface->dispatch (
+          msg, 0 /* rights don't matter */, l4_utcb ());
+      /* Note: be careful can't invoke any ipc between dispatch and ipc_call
+       * (do not modify utcb) */
+
+      /* the exit handler (invoked by the dispatch) will exit the worker */
+      if (not worker->alive ())
+        break;
+      /* no exit received -> wait for next RPC */
+      timeout = l4_timeout (L4_IPC_TIMEOUT_0, L4_IPC_TIMEOUT_NEVER);
+      if (timeout_us)
+        timeout.p.rcv = check_timeout (start, timeout_us);
+      msg = chkipc (
+          l4_ipc_call (worker->_thread.cap (), l4_utcb (), reply,
+                       L4_IPC_NEVER),
+          "Worker ipc failed."); /* use compound send and receive */
+    }
+}
+
+Worker_Handle::~Worker_Handle ()
+{
+  /* the epiface shares the worker, thus it has to be released as well
+   * before the process is actually destroyed */
+  worker.reset ();
+  if (not gate)
+    return;
+  gate->epiface->rebind (nullptr);
+  /* the process is gone, the gate and the allocator slot can be reused */
+  if (auto p = pool.lock ())
+    {
+      p->put_gate (std::move (gate));
+      if (memory_limit != 0)
+        p->put_allocator (std::move (allocator));
+    }
+}
+
+Worker_Pool::Worker_Pool (
+    std::shared_ptr<std::map<std::string, Action> > actions,
+    L4::Cap<L4::Thread> thread,
+    L4Re::Util::Shared_cap<L4::Scheduler> scheduler,
+    l4_sched_cpu_set_t affinity, Client_server *server,
+    Cpu_allocator::Client cpus)
+    : _actions (actions), _thread (thread), _scheduler (scheduler),
+      _affinity (affinity), _cpus (cpus), _server (server)
+{
+  if (options.stack_pool)
+    _stacks = std::make_shared<Stack_pool> (_server);
+  if (options.kobject_pool)
+    _kobjects = std::make_shared<Kobject_pool> (_server);
+  if (options.prelaunch and options.steal != Steal_policy::NONE)
+    {
+      _member = std::make_shared<Launch_board::Member> (_scheduler,
+                                                        _affinity);
+      chkcap (_server->registry ()->register_irq_obj (_member.get ()),
+              "launch board irq");
+      launch_board.join (_member.get ());
+    }
+}
+
+Worker_Pool::~Worker_Pool ()
+{
+  if (_idle_timeout.queued)
+    _server->remove_timeout (&_idle_timeout);
+}
+
+void
+Worker_Pool::follow_cpus ()
+{
+  Cpu_allocator::Cpu_set cpus;
+  if (L4_LIKELY (not cpu_allocator.moved (_cpus, cpus)))
+    return;
+
+  /* existing workers keep the old scheduler alive with their handles */
+  auto scheduler = cpu_allocator.scheduler (cpus);
+  auto affinity = Cpu_allocator::affinity (cpus);
+  l4_sched_param_t sp = l4_sched_param (L4RE_MAIN_THREAD_PRIO);
+  sp.affinity = affinity;
+  chksys (scheduler->run_thread (_thread, sp), "migrate client thread");
+  _scheduler = scheduler;
+  _affinity = affinity;
+  if (_member)
+    _member->set_scheduler (scheduler, affinity);
+}
+
+void
+Worker_Pool::update_idle ()
+{
+  if (_member)
+    _member->set_idle (not _invoking and _running.empty ());
+}
+
+std::unique_ptr<Worker_Handle>
+Worker_Pool::create (Action const &action, l4_mword_t memory_limit,
+                     std::list<std::string> argv, bool pooled)
+{
+  auto handle = std::make_unique<Worker_Handle> ();
+  handle->pool = weak_from_this ();
+  handle->gate = take_gate ();
+
+  handle->memory_limit = memory_limit;
+  if (memory_limit == 0)
+    {
+      /* default to own user factory == 'unlimited' memory */
+      /* user_factory wont be unmapped by the Shared_cap since it is not
+       * managed by the Util::cap_alloc */
+      handle->allocator = L4Re::Util::Shared_cap<L4::Factory> (
+          L4Re::Env::env ()->user_factory ());
+    }
+  else
+    /* use a limited allocator if limit is specified */
+    handle->allocator = take_allocator (memory_limit);
+
+  /* the process only gets a plain capability of the scheduler */
+  handle->scheduler = _scheduler;
+  handle->worker = std::make_shared<Worker> (
+      action.bin, action.image, handle->gate->cap.get (),
+      handle->scheduler.get (), handle->allocator.get (),
+      pooled ? _kobjects : nullptr);
+  /* pooled stacks are allocated by the manager, they would bypass the
+   * memory limit */
+  if (memory_limit == 0 and pooled)
+    handle->worker->_stack_pool = _stacks;
+  handle->gate->epiface->rebind (handle->worker);
+  handle->worker->_affinity = _affinity;
+  handle->worker->_placement = _next_placement++;
+
+  /* pass data as first argument string */
+  handle->worker->set_argv_strings (argv);
+  handle->worker->set_envp_strings ({ "PKGNAME=Worker    ", "LOG_LEVEL=31" });
+
+  handle->worker->add_initial_capability (
+      L4Re::Env::env ()->get_cap<L4Re::Namespace> ("rom"), "rom",
+      L4_cap_fpage_rights::L4_CAP_FPAGE_RW);
+  if (action.lang != MettEagle::Language::BINARY)
+    handle->worker->add_initial_capability (
+        action.ds.get (), "function", L4_cap_fpage_rights::L4_CAP_FPAGE_RW);
+  if (action.code.is_valid ())
+    handle->worker->add_initial_capability (
+        action.code.get (), "code", L4_cap_fpage_rights::L4_CAP_FPAGE_RO);
+  /* only the slots are reserved, the dataspaces are mapped per invocation */
+  handle->worker->add_initial_capability (
+      L4::Cap<void>::Invalid, "arg", L4_cap_fpage_rights::L4_CAP_FPAGE_RO);
+  handle->worker->add_initial_capability (
+      L4::Cap<void>::Invalid, "result", L4_cap_fpage_rights::L4_CAP_FPAGE_RW);
+
+  return handle;
+}
+
+std::unique_ptr<Worker_Handle>
+Worker_Pool::acquire (std::string const &name, std::string const &argument,
+                      MettEagle::Config cfg, MettEagle::Metadata &meta_data,
+                      Payload const *payload)
+{
+  /* c++ maps dont have a map#contains */
+  if (L4_UNLIKELY (_actions->count (name) == 0))
+    throw Loggable_exception (-L4_EINVAL, "Action '{}' doesn't exist", name);
+
+  /* cap can be unmapped anytime ... maybe we should create a local copy on
+   * action create?? ... TODO add try catch or some error handling */
+  auto action = (*_actions)[name];
+  if (L4_UNLIKELY (not action.ds.validate ().label ()))
+    throw Loggable_exception (-L4_EINVAL, "dataspace invalid");
+
+  /* the client might share its cpus with fewer clients elsewhere */
+  follow_cpus ();
+
+  /* prefer a parked worker of the same action */
+  auto handle = take (name, cfg.memory_limit);
+  meta_data.warm = handle != nullptr;
+  bool prelaunched = false;
+  if (not meta_data.warm and options.prelaunch)
+    {
+      handle = take_prelaunched (name, cfg.memory_limit);
+      prelaunched = handle != nullptr;
+    }
+  if (not handle)
+    /* pass data as first argument string */
+    handle = create (action, cfg.memory_limit, { argument });
+
+  if (payload)
+    {
+      handle->worker->map_capability ("arg", payload->arg);
+      handle->worker->map_capability ("result", payload->result);
+      handle->worker->set_payload (true, payload->arg_size);
+    }
+
+  /**
+   * The corresponding 'end' measurement will be taken in the exit ipc
+   * handler function
+   */
+  meta_data.start_worker = std::chrono::high_resolution_clock::now ();
+
+  if (meta_data.warm)
+    handle->worker->resume (argument);
+  else if (prelaunched)
+    {
+      /* the worker will fetch the argument once it is ready */
+      handle->worker->resume (argument);
+      chksys (handle->worker->start_thread (), "start prelaunched worker");
+    }
+  else
+    handle->worker->launch ();
+  // l4_debugger_set_object_name (handle->worker->_task.cap (), "wrkr");
+  // l4_debugger_set_object_name (handle->worker->_thread.cap (), "wrkr");
+  // l4_debugger_set_object_name (handle->worker->_rm.cap (), "wrkr rm");
+
+  return handle;
+}
+
+void
+Worker_Pool::unmap_payload (Worker_Handle &handle)
+{
+  /* a parked worker must not keep access to the client's memory */
+  handle.worker->unmap_capability ("arg");
+  handle.worker->unmap_capability ("result");
+  handle.worker->set_payload (false);
+}
+
+std::string
+Worker_Pool::release (std::string const &name,
+                      std::unique_ptr<Worker_Handle> handle,
+                      l4_mword_t memory_limit, MettEagle::Metadata &meta_data)
+{
+  // TODO return error code to parent
+  if (handle->worker->exited_with_error ())
+    throw Loggable_exception (-L4_EFAULT, "Worker exited with error");
+  auto exit_value = handle->worker->get_exit_value ();
+  auto worker_data = handle->gate->epiface->_metadata;
+
+  meta_data.start_runtime = worker_data.start_runtime;
+  meta_data.start_function = worker_data.start_function;
+  meta_data.end_function = worker_data.end_function;
+  meta_data.end_runtime = worker_data.end_runtime;
+  meta_data.result_length = worker_data.result_length;
+
+  if (handle->worker->parked () and not options.zygote)
+    /* keep the worker in case it is able to handle another invocation */
+    put (name, std::move (handle));
+  else
+    /* the teardown happens after the reply was sent */
+    retire (std::move (handle));
+
+  if (options.zygote)
+    /* the used worker is destroyed, prepare a fresh one instead */
+    prepare (name, memory_limit);
+  else if (options.prelaunch)
+    /* load the worker of the next invocation in the meantime */
+    prelaunch (name, memory_limit);
+
+  meta_data.end_worker = std::chrono::high_resolution_clock::now ();
+  return exit_value;
+}
+
+std::string
+Worker_Pool::invoke (std::string const &name, std::string const &argument,
+                     MettEagle::Config cfg, MettEagle::Metadata &meta_data,
+                     Payload const *payload)
+{
+  /**
+   * Note: One needs to be very careful here. On deletion the smart
+   * capabilities of the worker will unmap their managed capabilities. This
+   * unmap will be a systemcall itself and again mess up the utcb.
+   *
+   * Thus the caller has to set its return values after this function
+   * returned.
+   */
+  /* no work is stolen while the thread serves the worker */
+  struct Invoking
+  {
+    Worker_Pool *pool;
+    Invoking (Worker_Pool *p) : pool (p)
+    {
+      pool->_invoking++;
+      pool->update_idle ();
+    }
+    ~Invoking ()
+    {
+      pool->_invoking--;
+      pool->update_idle ();
+    }
+  } invoking (this);
+
+  auto handle = acquire (name, argument, cfg, meta_data, payload);
+  handle->run (cfg.timeout_us, meta_data.start_worker, meta_data.warm);
+  if (payload)
+    unmap_payload (*handle);
+  return release (name, std::move (handle), cfg.memory_limit, meta_data);
+}
+
+void
+Async_run::expired ()
+{
+  /* the timeout was already removed from the queue */
+  queued = false;
+  if (auto p = pool.lock ())
+    p->finish (this, -L4_EFAULT);
+}
+
+std::shared_ptr<Async_run>
+Worker_Pool::invoke_async (std::string const &name,
+                           std::string const &argument, MettEagle::Config cfg,
+                           Completion done)
+{
+  auto run = std::make_shared<Async_run> ();
+  run->pool = weak_from_this ();
+  run->name = name;
+  run->cfg = cfg;
+  run->done = done;
+  run->handle = acquire (name, argument, cfg, run->data);
+
+  /* the worker reports its result with an ipc to its gate, which is received
+   * by the server loop of the client thread */
+  std::weak_ptr<Worker_Pool> weak_pool = shared_from_this ();
+  Async_run *raw = run.get ();
+  run->handle->gate->epiface->_on_done = [weak_pool, raw] {
+    if (auto pool = weak_pool.lock ())
+      pool->finish (raw, L4_EOK);
+  };
+
+  if (run->data.warm)
+    /* only wake up the parked worker, without waiting for it */
+    chkipc (l4_ipc_send (run->handle->worker->_thread.cap (), l4_utcb (),
+                         l4_msgtag (L4_EOK, 0, 0, 0), L4_IPC_SEND_TIMEOUT_0),
+            "Worker ipc failed.");
+
+  if (cfg.timeout_us)
+    {
+      _server->add_timeout (run.get (), _server->now () + cfg.timeout_us);
+      run->queued = true;
+    }
+  _running.push_back (run);
+  update_idle ();
+  return run;
+}
+
+void
+Worker_Pool::wait (std::shared_ptr<Async_run> const &run)
+{
+  if (std::find (_running.begin (), _running.end (), run) == _running.end ())
+    return;
+
+  try
+    {
+      /* serve only this worker until it is done, the epiface will finish the
+       * invocation */
+      run->handle->run (run->cfg.timeout_us, run->data.start_worker, false);
+    }
+  catch (Loggable_exception &e)
+    {
+      log<ERROR> (e);
+      finish (run.get (), e.err_no ());
+    }
+  catch (L4::Runtime_error &e)
+    {
+      log<ERROR> (e);
+      finish (run.get (), e.err_no ());
+    }
+}
+
+void
+Worker_Pool::finish (Async_run *raw, long error)
+{
+  auto it = std::find_if (_running.begin (), _running.end (),
+                          [raw] (auto const &run) { return run.get () == raw; });
+  if (it == _running.end ())
+    return;
+  /* keep the run alive until the completion was called */
+  auto run = *it;
+  _running.erase (it);
+  update_idle ();
+
+  if (run->queued)
+    _server->remove_timeout (run.get ());
+  run->handle->gate->epiface->_on_done = nullptr;
+
+  std::string value;
+  if (error == L4_EOK and run->handle->worker->exited_with_error ())
+    error = -L4_EFAULT;
+  if (error == L4_EOK)
+    value = release (run->name, std::move (run->handle),
+                     run->cfg.memory_limit, run->data);
+  else
+    /* this might be called by the epiface of the worker, thus it must not
+     * be destroyed right away */
+    retire (std::move (run->handle));
+
+  run->done (error, value, run->data);
+}
+
+std::unique_ptr<Parent_gate>
+Worker_Pool::take_gate ()
+{
+  if (not _gates.empty ())
+    {
+      auto gate = std::move (_gates.front ());
+      _gates.pop_front ();
+      return gate;
+    }
+
+  auto gate = std::make_unique<Parent_gate> ();
+  gate->cap
+      = chkcap (L4Re::Util::make_shared_cap<MettEagle::Manager_Worker> (),
+                "alloc parent cap", -L4_ENOMEM);
+  /* create the ipc handler, it will be bound to a worker later on */
+  gate->epiface = std::make_unique<Manager_Worker_Epiface> (
+      _actions, shared_from_this (), _thread, _scheduler, nullptr);
+  /* link parent capability to ipc gate */
+  chksys (L4Re::Env::env ()->factory ()->create_gate (
+              gate->cap.get (), _thread, l4_umword_t (gate->epiface.get ())),
+          "Failed to create gate");
+  // l4_debugger_set_object_name (gate->cap.cap (), "wrkr->mngr");
+  gate->server = std::make_unique<L4::Ipc_svr::Default_loop_hooks> ();
+  gate->epiface->set_server (gate->server.get (), gate->cap.get ());
+  return gate;
+}
+
+void
+Worker_Pool::put_gate (std::unique_ptr<Parent_gate> gate)
+{
+  /* the gate will be destroyed at the end of the scope */
+  if (_gates.size () >= options.kobject_pool)
+    return;
+
+  /* the worker might have passed its parent capability to other tasks */
+  L4Re::Env::env ()->task ()->unmap (gate->cap.fpage (), L4_FP_OTHER_SPACES);
+  _gates.push_back (std::move (gate));
+}
+
+L4Re::Util::Shared_cap<L4::Factory>
+Worker_Pool::take_allocator (l4_mword_t limit)
+{
+  L4Re::Util::Shared_cap<L4::Factory> allocator;
+  if (not _allocator_slots.empty ())
+    {
+      allocator = std::move (_allocator_slots.front ());
+      _allocator_slots.pop_front ();
+    }
+  else
+    allocator = chkcap (L4Re::Util::make_shared_cap<L4::Factory> (),
+                        "alloc allocator cap", -L4_ENOMEM);
+
+  /* create limited allocator, it always starts without any usage */
+  chksys (l4_msgtag_t (
+              L4Re::Env::env ()->user_factory ()->create (allocator.get ())
+              << limit),
+          "create limited allocator");
+  return allocator;
+}
+
+void
+Worker_Pool::put_allocator (L4Re::Util::Shared_cap<L4::Factory> allocator)
+{
+  /* the allocator will be destroyed at the end of the scope */
+  if (_allocator_slots.size () >= options.kobject_pool)
+    return;
+
+  /* deleting the allocator releases the memory of the worker, the empty
+   * slot can be used for the next allocator */
+  L4Re::Env::env ()->task ()->unmap (allocator.fpage (), L4_FP_ALL_SPACES);
+  _allocator_slots.push_back (std::move (allocator));
+}
+
+void
+Worker_Pool::evict_expired ()
+{
+  auto now = std::chrono::high_resolution_clock::now ();
+  for (auto &[name, workers] : _idle)
+    /* the oldest workers are at the front of the list */
+    while (not workers.empty ()
+           and now - workers.front ()->idle_since > options.keep_alive)
+      {
+        retire (std::move (workers.front ()));
+        workers.pop_front ();
+        _idle_count--;
+      }
+  for (auto it = _prelaunched.begin (); it != _prelaunched.end ();)
+    if (now - it->second->idle_since > options.keep_alive)
+      {
+        retire (std::move (it->second));
+        it = _prelaunched.erase (it);
+      }
+    else
+      it++;
+  schedule_eviction ();
+}
+
+void
+Worker_Pool::schedule_eviction ()
+{
+  if (_idle_timeout.queued)
+    {
+      _server->remove_timeout (&_idle_timeout);
+      _idle_timeout.queued = false;
+    }
+
+  /* the oldest workers are at the front of the lists */
+  bool found = false;
+  std::chrono::time_point<std::chrono::high_resolution_clock> oldest;
+  auto consider = [&] (Worker_Handle const &handle) {
+    if (not found or handle.idle_since < oldest)
+      oldest = handle.idle_since;
+    found = true;
+  };
+  for (auto const &[name, workers] : _idle)
+    if (not workers.empty ())
+      consider (*workers.front ());
+  for (auto const &[name, handle] : _prelaunched)
+    consider (*handle);
+  if (not found)
+    return;
+
+  auto remaining = std::chrono::duration_cast<std::chrono::microseconds> (
+      oldest + options.keep_alive - std::chrono::high_resolution_clock::now ());
+  /* expire just after the keep alive time, see ::evict_expired() */
+  auto delay_us = std::max<l4_int64_t> (remaining.count (), 0) + 1;
+  _server->add_timeout (&_idle_timeout, _server->now () + delay_us);
+  _idle_timeout.queued = true;
+}
+
+void
+Idle_timeout::expired ()
+{
+  /* the timeout was already removed from the queue */
+  queued = false;
+  pool->evict_expired ();
+}
+
+std::unique_ptr<Worker_Handle>
+Worker_Pool::take (std::string const &name, l4_mword_t memory_limit)
+{
+  evict_expired ();
+
+  auto entry = _idle.find (name);
+  if (entry == _idle.end ())
+    return nullptr;
+
+  /* prefer the most recently used worker */
+  auto &workers = entry->second;
+  for (auto it = workers.rbegin (); it != workers.rend (); it++)
+    if ((*it)->memory_limit == memory_limit)
+      {
+        auto handle = std::move (*it);
+        workers.erase (std::next (it).base ());
+        _idle_count--;
+        return handle;
+      }
+  return nullptr;
+}
+
+void
+Worker_Pool::put (std::string const &name,
+                  std::unique_ptr<Worker_Handle> handle)
+{
+  evict_expired ();
+
+  if (_idle_count >= options.pool_size)
+    return retire (std::move (handle));
+
+  handle->idle_since = std::chrono::high_resolution_clock::now ();
+  _idle[name].push_back (std::move (handle));
+  _idle_count++;
+  schedule_eviction ();
+}
+
+void
+Worker_Pool::retire (std::unique_ptr<Worker_Handle> handle)
+{
+  /* bound the backlog -- the oldest worker is destroyed right away */
+  if (_retired.size () >= Retire_backlog)
+    _retired.pop_front ();
+
+  /* a single deferred teardown handles all workers retired until then */
+  if (_retired.empty ())
+    Deferred::schedule (_server, shared_from_this (),
+                        [] (Worker_Pool &pool) { pool._retired.clear (); });
+  _retired.push_back (std::move (handle));
+}
+
+void
+Worker_Pool::prepare (std::string const &name, l4_mword_t memory_limit)
+{
+  Deferred::schedule (
+      _server, shared_from_this (),
+      [name, memory_limit] (Worker_Pool &pool) {
+        /* the action might have been deleted in the meantime */
+        auto entry = pool._actions->find (name);
+        if (entry == pool._actions->end ())
+          return;
+        /* a zygote is started without an argument */
+        auto handle = pool.create (entry->second, memory_limit, {});
+        handle->worker->launch ();
+        handle->run (Zygote_timeout_us,
+                     std::chrono::high_resolution_clock::now (), false);
+        if (L4_UNLIKELY (not handle->worker->parked ()))
+          throw Loggable_exception (-L4_EINVAL,
+                                    "Zygote of '{:s}' exited before its start",
+                                    name);
+        pool.put (name, std::move (handle));
+      });
+}
+
+void
+Worker_Pool::prelaunch (std::string const &name, l4_mword_t memory_limit)
+{
+  Deferred::schedule (
+      _server, shared_from_this (),
+      [name, memory_limit] (Worker_Pool &pool) {
+        auto entry = pool._actions->find (name);
+        if (entry == pool._actions->end ())
+          return;
+        if (pool._prelaunched.count (name) or pool._loading.count (name))
+          return;
+        /* the next invocation will be handled by a parked worker anyway */
+        auto idle = pool._idle.find (name);
+        if (idle != pool._idle.end ())
+          for (auto &handle : idle->second)
+            if (handle->memory_limit == memory_limit)
+              return;
+
+        /* the argument is fetched once the worker was started */
+        auto handle
+            = pool.create (entry->second, memory_limit, {}, not pool._member);
+        if (pool._member)
+          {
+            handle = pool.post_prelaunch (name, std::move (handle));
+            if (not handle)
+              {
+                pool._loading.insert (name);
+                return;
+              }
+          }
+        handle->worker->prelaunch ();
+        pool.add_prelaunched (name, std::move (handle));
+      });
+}
+
+std::unique_ptr<Worker_Handle>
+Worker_Pool::post_prelaunch (std::string const &name,
+                             std::unique_ptr<Worker_Handle> handle)
+{
+  /* the job must be copyable, thus the handle is shared until it is taken */
+  auto slot = std::make_shared<std::unique_ptr<Worker_Handle> > (
+      std::move (handle));
+  std::shared_ptr<Launch_board::Member> owner = _member;
+  Launch_board::Job job = [slot, owner, name] (Launch_board::Member &thief) {
+    auto loaded = std::make_shared<std::unique_ptr<Worker_Handle> > (
+        std::move (*slot));
+    if (options.steal == Steal_policy::STEALER)
+      {
+        (*loaded)->worker->_run_scheduler = thief.scheduler ();
+        (*loaded)->worker->_affinity = thief.affinity ();
+      }
+    long error = L4_EOK;
+    try
+      {
+        (*loaded)->worker->prelaunch ();
+      }
+    catch (Loggable_exception &e)
+      {
+        log<ERROR> (e);
+        error = e.err_no ();
+      }
+    catch (L4::Runtime_error &e)
+      {
+        log<ERROR> (e);
+        error = e.err_no ();
+      }
+
+    bool handed_back = owner->complete ([loaded, name, error] {
+      auto pool = (*loaded)->pool.lock ();
+      if (not pool)
+        return;
+      pool->_loading.erase (name);
+      if (error != L4_EOK)
+        pool->retire (std::move (*loaded));
+      else
+        pool->add_prelaunched (name, std::move (*loaded));
+    });
+    /* the owner is gone, its pool must not be touched by this thread */
+    if (not handed_back)
+      (*loaded)->pool.reset ();
+  };
+  if (launch_board.post (*_member, job))
+    return nullptr;
+  return std::move (*slot);
+}
+
+void
+Worker_Pool::add_prelaunched (std::string const &name,
+                              std::unique_ptr<Worker_Handle> handle)
+{
+  /* the action was invoked again while the worker was loaded */
+  if (_prelaunched.count (name))
+    {
+      retire (std::move (handle));
+      return;
+    }
+  handle->idle_since = std::chrono::high_resolution_clock::now ();
+  _prelaunched[name] = std::move (handle);
+  schedule_eviction ();
+}
+
+std::unique_ptr<Worker_Handle>
+Worker_Pool::take_prelaunched (std::string const &name,
+                               l4_mword_t memory_limit)
+{
+  auto entry = _prelaunched.find (name);
+  if (entry == _prelaunched.end ())
+    return nullptr;
+
+  auto handle = std::move (entry->second);
+  _prelaunched.erase (entry);
+  /* the worker doesn't fit, but the next invocation probably has the same
+   * memory limit as this one */
+  if (handle->memory_limit != memory_limit)
+    {
+      retire (std::move (handle));
+      return nullptr;
+    }
+  return handle;
+}
+
+void
+Worker_Pool::remove (std::string const &name)
+{
+  _prelaunched.erase (name);
+  auto entry = _idle.find (name);
+  if (entry == _idle.end ())
+    return;
+  _idle_count -= entry->second.size ();
+  _idle.erase (entry);
+}
+
+void
+Worker_Pool::clear ()
+{
+  for (auto &run : _running)
+    if (run->queued)
+      _server->remove_timeout (run.get ());
+  _running.clear ();
+  /* loaded workers handed back later are destroyed by the other thread */
+  if (_member)
+    {
+      _member->close ();
+      launch_board.leave (_member.get ());
+      _server->registry ()->unregister_obj (_member.get ());
+    }
+  _loading.clear ();
+  _idle.clear ();
+  _idle_count = 0;
+  _prelaunched.clear ();
+  if (_idle_timeout.queued)
+    {
+      _server->remove_timeout (&_idle_timeout);
+      _idle_timeout.queued = false;
+    }
+  _retired.clear ();
+  /* the destroyed workers returned their gates and allocators */
+  _gates.clear ();
+  _allocator_slots.clear ();
+}
@@ -0,0 +1,509 @@
+/**
+ * (c) 2023 Max Kurze <max.kurze@mailbox.tu-dresden.de>
+ *
+ * This file is distributed under the terms of the
+ * GNU General Public License 2.
+ * Please see the LICENSE.md file for details.
+ */
+/**
+ * @file
+ * Creation and reuse of worker processes
+ *
+ * Every client has its own pool. It holds the workers that handed over the
+ * result of an invocation, but are still able to handle further invocations
+ * of the same action.
+ */
+
+#pragma once
+
+#include "cpu_allocator.h"
+#include "deferred.h"
+#include "kobject_pool.h"
+#include "launch_board.h"
+#include "manager.h"
+#include "manager_base.h"
+#include "manager_worker.h"
+#include "stack_pool.h"
+#include "worker.h"
+
+#include <l4/mett-eagle/base>
+
+#include <l4/re/dataspace>
+#include <l4/re/util/shared_cap>
+#include <l4/sys/cxx/ipc_server_loop>
+#include <l4/sys/cxx/ipc_timeout_queue>
+#include <l4/sys/scheduler>
+#include <l4/sys/thread>
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+/**
+ * @brief Ipc gate that is passed to a worker as parent capability
+ *
+ * The gate and its epiface can be reused by several workers (one after the
+ * other, see Worker_Pool::put_gate()).
+ */
+struct Parent_gate
+{
+  L4Re::Util::Shared_cap<MettEagle::Manager_Worker> cap;
+
+  /** ipc handler for the started process */
+  std::unique_ptr<Manager_Worker_Epiface> epiface;
+  std::unique_ptr<L4::Ipc_svr::Default_loop_hooks> server;
+};
+
+class Worker_Pool;
+
+/**
+ * @brief Dataspaces of an invocation that are mapped into the worker
+ *
+ * Every worker reserves the slots "arg" and "result" for them (see
+ * Worker_Pool::create()), thus parked and prelaunched workers can handle
+ * such an invocation as well.
+ */
+struct Payload
+{
+  /** read only dataspace with the argument */
+  L4::Cap<L4Re::Dataspace> arg;
+  /** size of the argument inside its dataspace */
+  l4_umword_t arg_size;
+  /** writable dataspace the worker puts its result into */
+  L4::Cap<L4Re::Dataspace> result;
+};
+
+/**
+ * @brief All objects that belong to a single worker process
+ *
+ * The process is destroyed before its ipc gate and memory allocator are
+ * released (see ~Worker_Handle()).
+ */
+struct Worker_Handle
+{
+  /** pool the gate is returned to */
+  std::weak_ptr<Worker_Pool> pool;
+
+  std::unique_ptr<Parent_gate> gate;
+
+  /**
+   * scheduler of the worker, the process only has a plain capability, thus
+   * the handle keeps it as long as the process exists (the client thread
+   * might switch to another one, see Worker_Pool::follow_cpus())
+   */
+  L4Re::Util::Shared_cap<L4::Scheduler> scheduler;
+
+  /** memory allocator of the worker (might be a limited one) */
+  L4Re::Util::Shared_cap<L4::Factory> allocator;
+
+  /** memory limit the allocator was created with (0 = unlimited) */
+  l4_mword_t memory_limit = 0;
+
+  std::shared_ptr<Worker> worker;
+
+  /** point in time the worker was put into the pool */
+  std::chrono::time_point<std::chrono::high_resolution_clock> idle_since;
+
+  /**
+   * @brief Serve the worker until it exits or parks
+   *
+   * @param timeout_us  Maximum runtime of the worker (0 = no limit)
+   * @param start       Start of the time measurement for the timeout
+   * @param resume      Wake up a parked worker before waiting for it
+   *
+   * @throws Loggable_exception(-L4_EFAULT) on timeout
+   */
+  void run (l4_uint32_t timeout_us,
+            std::chrono::time_point<std::chrono::high_resolution_clock> start,
+            bool resume);
+
+  ~Worker_Handle ();
+};
+
+/**
+ * @brief Called once an asynchronous invocation is finished
+ *
+ * @param error  L4_EOK or the error the invocation failed with
+ * @param value  Result of the invocation
+ * @param data   Measured metadata of the invocation
+ */
+typedef std::function<void (long error, std::string const &value,
+                            MettEagle::Metadata const &data)>
+    Completion;
+
+/**
+ * @brief A worker that runs without blocking the client thread
+ *
+ * The ipc of the worker is received by the server loop of the client thread
+ * (see Worker_Pool::invoke_async()). The timeout of the invocation is part of
+ * the timeout queue of that loop.
+ */
+struct Async_run : public L4::Ipc_svr::Timeout
+{
+  std::weak_ptr<Worker_Pool> pool;
+
+  std::string name;
+  MettEagle::Config cfg;
+  MettEagle::Metadata data;
+  Completion done;
+
+  std::unique_ptr<Worker_Handle> handle;
+
+  /** set while the timeout is part of the queue */
+  bool queued = false;
+
+  void expired () override;
+};
+
+/**
+ * @brief Destroys the idle workers of a pool once their keep alive time
+ * expired (see Options::keep_alive)
+ *
+ * The timeout is part of the timeout queue of the client thread, thus idle
+ * workers are destroyed even while the client doesn't invoke anything.
+ */
+struct Idle_timeout : public L4::Ipc_svr::Timeout
+{
+  Worker_Pool *pool;
+
+  /** set while the timeout is part of the queue */
+  bool queued = false;
+
+  explicit Idle_timeout (Worker_Pool *p) : pool (p) {}
+
+  void expired () override;
+};
+
+class Worker_Pool : public std::enable_shared_from_this<Worker_Pool>
+{
+  friend struct Idle_timeout;
+
+private:
+  /** actions of the client, passed to the epifaces of created workers */
+  std::shared_ptr<std::map<std::string, Action> > _actions;
+
+  /** client thread that will serve the workers */
+  L4::Cap<L4::Thread> _thread;
+
+  /** scheduler that is used by the workers */
+  L4Re::Util::Shared_cap<L4::Scheduler> _scheduler;
+
+  /** cpus the threads are run on with _scheduler */
+  l4_sched_cpu_set_t _affinity;
+
+  /** cpus of the client in the cpu allocator */
+  Cpu_allocator::Client _cpus;
+
+  /**
+   * @brief Migrate the client thread in case the client was moved to other
+   * cpus (see Cpu_allocator::moved())
+   *
+   * Only workers created afterwards use the new cpus. Existing workers keep
+   * the scheduler they were created with (see Worker_Handle::scheduler).
+   */
+  void follow_cpus ();
+
+  /** server loop of the client thread, used to defer work */
+  Client_server *_server;
+
+  /** recycled stacks of the workers (nullptr if disabled) */
+  std::shared_ptr<Stack_pool> _stacks;
+
+  /** recycled kernel objects of the workers (nullptr if disabled) */
+  std::shared_ptr<Kobject_pool> _kobjects;
+
+  /** parked workers sorted by the name of their action */
+  std::map<std::string, std::list<std::unique_ptr<Worker_Handle> > > _idle;
+
+  /** placement of the next created worker (see App_model::_placement) */
+  unsigned _next_placement = 0;
+
+  /** number of workers in _idle */
+  unsigned _idle_count = 0;
+
+  /** unused parent gates */
+  std::list<std::unique_ptr<Parent_gate> > _gates;
+
+  std::unique_ptr<Parent_gate> take_gate ();
+
+  /**
+   * capability slots of destroyed limited memory allocators, they are empty
+   * and get the next allocator
+   */
+  std::list<L4Re::Util::Shared_cap<L4::Factory> > _allocator_slots;
+
+  /** create a limited memory allocator, in a pooled slot if available */
+  L4Re::Util::Shared_cap<L4::Factory> take_allocator (l4_mword_t limit);
+
+  void evict_expired ();
+
+  /** expires with the keep alive time of the oldest idle worker */
+  Idle_timeout _idle_timeout{ this };
+
+  /** (re)queue ::_idle_timeout for the oldest idle or prelaunched worker */
+  void schedule_eviction ();
+
+  /** loaded but not yet started workers sorted by the name of their action
+   * (see Options::prelaunch) */
+  std::map<std::string, std::unique_ptr<Worker_Handle> > _prelaunched;
+
+  /** workers of asynchronous invocations that are not finished yet */
+  std::list<std::shared_ptr<Async_run> > _running;
+
+  /** member of the launch board (nullptr if work stealing is disabled) */
+  std::shared_ptr<Launch_board::Member> _member;
+
+  /** actions whose worker is currently loaded by another client thread */
+  std::set<std::string> _loading;
+
+  /** number of synchronous invocations the client thread is serving */
+  unsigned _invoking = 0;
+
+  /** tell the launch board whether the client thread is serving a worker */
+  void update_idle ();
+
+  /**
+   * @brief Let an idle client thread load a prelaunched worker
+   *
+   * @return  nullptr if the loading was posted, otherwise the handle, which
+   *          has to be loaded by the caller
+   */
+  std::unique_ptr<Worker_Handle>
+  post_prelaunch (std::string const &name,
+                  std::unique_ptr<Worker_Handle> handle);
+
+  /** keep a loaded worker until the next invocation of its action */
+  void add_prelaunched (std::string const &name,
+                        std::unique_ptr<Worker_Handle> handle);
+
+  /**
+   * @brief Get a worker for an invocation and start it
+   *
+   * A parked worker is only marked as resumed, the caller has to wake it up.
+   * The dataspaces of the payload are mapped before the worker runs, the
+   * caller has to unmap them once it is done (see ::unmap_payload()).
+   */
+  std::unique_ptr<Worker_Handle> acquire (std::string const &name,
+                                          std::string const &argument,
+                                          MettEagle::Config cfg,
+                                          MettEagle::Metadata &meta_data,
+                                          Payload const *payload = nullptr);
+
+  /** revoke the dataspaces of a payload from the worker */
+  void unmap_payload (Worker_Handle &handle);
+
+  /**
+   * @brief Collect the result of a worker that exited or parked and put it
+   * back into the pool (or destroy it)
+   *
+   * @throws Loggable_exception(-L4_EFAULT) if the worker failed
+   */
+  std::string release (std::string const &name,
+                       std::unique_ptr<Worker_Handle> handle,
+                       l4_mword_t memory_limit,
+                       MettEagle::Metadata &meta_data);
+
+  /** destroyed workers that wait for their teardown */
+  std::list<std::unique_ptr<Worker_Handle> > _retired;
+
+public:
+  Worker_Pool (std::shared_ptr<std::map<std::string, Action> > actions,
+               L4::Cap<L4::Thread> thread,
+               L4Re::Util::Shared_cap<L4::Scheduler> scheduler,
+               l4_sched_cpu_set_t affinity, Client_server *server,
+               Cpu_allocator::Client cpus);
+
+  ~Worker_Pool ();
+
+  /** Number of cpus the workers of the client currently run on */
+  unsigned
+  cpu_count () const
+  {
+    return cpu_allocator.count (_cpus);
+  }
+
+  /**
+   * @brief Create a new worker process for an action
+   *
+   * All kernel objects of the process will be created, but the process is
+   * not yet launched (see Worker::launch())
+   *
+   * @param action        The action the worker should execute
+   * @param memory_limit  Memory limit of the worker in bytes (0 = no limit)
+   * @param argv          Program arguments of the worker
+   * @param pooled        Use the stack and kernel object pool of the client
+   *                      thread, they must not be used if the worker is
+   *                      loaded by another thread
+   */
+  std::unique_ptr<Worker_Handle> create (Action const &action,
+                                         l4_mword_t memory_limit,
+                                         std::list<std::string> argv,
+                                         bool pooled = true);
+
+  /**
+   * @brief Invoke an action and wait for its result
+   *
+   * A parked or prelaunched worker is used if available, otherwise a new one
+   * is created. Afterwards the worker is put back into the pool or destroyed.
+   *
+   * @param name       Name of the action
+   * @param argument   Argument of the invocation
+   * @param cfg        Configuration of the invocation
+   * @param meta_data  Measured metadata of the invocation
+   * @param payload    Dataspaces the worker gets for this invocation, if set
+   *
+   * @return  The result of the invocation
+   *
+   * @throws Loggable_exception(-L4_EINVAL) if the action doesn't exist
+   * @throws Loggable_exception(-L4_EFAULT) if the worker failed or timed out
+   */
+  std::string invoke (std::string const &name, std::string const &argument,
+                      MettEagle::Config cfg, MettEagle::Metadata &meta_data,
+                      Payload const *payload = nullptr);
+
+  /**
+   * @brief Invoke an action without waiting for its result
+   *
+   * The worker is started like by ::invoke(), but the client thread returns
+   * to its server loop right away. The ipc of the worker is received there,
+   * thus several workers can run at the same time. Nested invocations of
+   * such a worker are executed synchronously.
+   *
+   * @param name      Name of the action
+   * @param argument  Argument of the invocation
+   * @param cfg       Configuration of the invocation
+   * @param done      Called once the worker exited or parked, the timeout
+   *                  expired or the worker failed
+   *
+   * @return  Handle of the invocation that can be passed to ::wait()
+   *
+   * @throws Loggable_exception(-L4_EINVAL) if the action doesn't exist
+   */
+  std::shared_ptr<Async_run> invoke_async (std::string const &name,
+                                           std::string const &argument,
+                                           MettEagle::Config cfg,
+                                           Completion done);
+
+  /**
+   * @brief Block the client thread until an asynchronous invocation is
+   * finished
+   *
+   * Only the worker of this invocation is served in the meantime.
+   */
+  void wait (std::shared_ptr<Async_run> const &run);
+
+  /**
+   * @brief Finish an asynchronous invocation and call its completion
+   *
+   * @param run    The invocation, nothing happens if it was already finished
+   * @param error  L4_EOK if the worker exited or parked, otherwise the error
+   *               the invocation failed with
+   */
+  void finish (Async_run *run, long error);
+
+  /**
+   * @brief Take a parked worker out of the pool
+   *
+   * @param name          Name of the action
+   * @param memory_limit  The memory limit the worker must have been created
+   *                      with
+   *
+   * @return  A parked worker or nullptr if there is none
+   */
+  std::unique_ptr<Worker_Handle> take (std::string const &name,
+                                       l4_mword_t memory_limit);
+
+  /**
+   * @brief Put a parked worker back into the pool
+   *
+   * In case the pool is already full, the worker will be destroyed.
+   *
+   * @param name    Name of the action the worker is executing
+   * @param handle  The parked worker
+   */
+  void put (std::string const &name, std::unique_ptr<Worker_Handle> handle);
+
+  /**
+   * @brief Destroy a worker once the current reply was sent
+   *
+   * This moves the teardown of the process off the critical path. In case
+   * too many workers are already waiting for their teardown, the oldest one
+   * is destroyed immediately.
+   */
+  void retire (std::unique_ptr<Worker_Handle> handle);
+
+  /**
+   * @brief Prepare a zygote of an action once the current reply was sent
+   *
+   * The zygote is a new worker process that completed its runtime setup and
+   * waits for its first invocation (see Manager_Worker::ready()). It will be
+   * put into the pool.
+   *
+   * @param name          Name of the action
+   * @param memory_limit  Memory limit of the worker in bytes (0 = no limit)
+   */
+  void prepare (std::string const &name, l4_mword_t memory_limit);
+
+  /**
+   * @brief Load a worker of an action once the current reply was sent
+   *
+   * The worker is not started (see Worker::prelaunch()). Only one such worker
+   * is kept per action, none is loaded if there is a parked worker of the
+   * action anyway. The loading might be executed by an idle client thread
+   * (see Options::steal).
+   *
+   * @param name          Name of the action
+   * @param memory_limit  Memory limit of the worker in bytes (0 = no limit)
+   */
+  void prelaunch (std::string const &name, l4_mword_t memory_limit);
+
+  /**
+   * @brief Take the loaded but not yet started worker of an action
+   *
+   * @param name          Name of the action
+   * @param memory_limit  The memory limit the worker must have been created
+   *                      with
+   *
+   * @return  The worker or nullptr if there is none
+   */
+  std::unique_ptr<Worker_Handle> take_prelaunched (std::string const &name,
+                                                   l4_mword_t memory_limit);
+
+  /**
+   * @brief Put the parent gate of a destroyed worker back into the pool
+   *
+   * All mappings of the gate to other tasks are revoked, thus the gate can
+   * be handed to the next worker. The gate will be destroyed if the pool is
+   * full (see Options::kobject_pool).
+   */
+  void put_gate (std::unique_ptr<Parent_gate> gate);
+
+  /**
+   * @brief Destroy the limited memory allocator of a destroyed worker and
+   * keep its capability slot
+   *
+   * The memory the worker allocated is accounted to the allocator until the
+   * allocator itself is destroyed, thus it is never handed to another
+   * worker. Only the slot is put into the pool, unless the pool is full (see
+   * Options::kobject_pool).
+   */
+  void put_allocator (L4Re::Util::Shared_cap<L4::Factory> allocator);
+
+  /**
+   * @brief Destroy all parked and prelaunched workers of an action
+   */
+  void remove (std::string const &name);
+
+  /**
+   * @brief Destroy all parked workers
+   *
+   * Note: The epifaces of parked workers and unused gates reference the pool
+   * themselves. So this has to be called to break the cycle once the client
+   * leaves.
+   */
+  void clear ();
+};
@@ -0,0 +1,14 @@
+#include <l4/libfaas/faas>
+
+#include <cstring>
+
+/* copies the argument dataspace into the result dataspace */
+std::string Main(std::string args) {
+  if (not L4Re::Faas::has_payload ())
+    return "no dataspaces";
+  auto arg = L4Re::Faas::argument_view ();
+  auto result = L4Re::Faas::result_view ();
+  L4Re::Faas::set_result_length (arg.size);
+  memcpy (result.data, arg.data, arg.size);
+  return "copied " + args;
+}
@@ -1,9 +1,15 @@
 #include <gtest/gtest.h>
 
 #include <l4/mett-eagle/util>
+#include <l4/re/dataspace>
 #include <l4/re/env>
+#include <l4/re/mem_alloc>
+#include <l4/re/rm>
+#include <l4/re/util/unique_cap>
 
+#include <cstring>
 #include <string>
+#include <vector>
 
 
 TEST (MettEagle, SimpleInvoke)
@@ -58,4 +64,221 @@ TEST (MettEagle, NameCollision)
   EXPECT_THROW ([&]{
     L4Re::chksys (manager->action_create ("some-special-name", "example-function"));
   }, L4::Element_already_exists);
-}
\ No newline at end of file
+}
+
+TEST (MettEagle, InvalidBinary)
+{
+  /**
+   * Should throw an error if the dataspace doesn't contain an ELF binary
+   */
+  auto manager = L4Re::MettEagle::getManager ("manager");
+
+  /* freshly allocated memory is zeroed -- no ELF header */
+  auto ds = L4Re::chkcap (L4Re::Util::make_unique_cap<L4Re::Dataspace> ());
+  L4Re::chksys (
+      L4Re::Env::env ()->mem_alloc ()->alloc (L4_PAGESIZE, ds.get ()));
+
+  EXPECT_THROW (
+      L4Re::chksys (manager->action_create ("invalid-binary", ds.get ())),
+      L4::Runtime_error);
+}
+
+TEST (MettEagle, Prewarm)
+{
+  /**
+   * Invocations after a prewarm should be served by a prepared worker (the
+   * manager is started with a worker pool, see test.cfg)
+   */
+  auto manager = L4Re::MettEagle::getManager ("manager");
+
+  L4Re::chksys (manager->action_create ("prewarmed", "example-function"));
+  EXPECT_NO_THROW (L4Re::chksys (manager->action_prewarm ("prewarmed", 2)));
+
+  std::string answer;
+  L4Re::MettEagle::Metadata data;
+  EXPECT_NO_THROW (L4Re::chksys (manager->action_invoke (
+      "prewarmed", "some test argument", answer, {}, &data)));
+  EXPECT_EQ (answer, std::string ("example function answer"));
+  EXPECT_TRUE (data.warm);
+
+  /* only existing actions can be prewarmed */
+  EXPECT_THROW (L4Re::chksys (manager->action_prewarm ("does-not-exist", 1)),
+                L4::Runtime_error);
+}
+
+TEST (MettEagle, AsyncInvoke)
+{
+  /**
+   * Several invocations can be in flight, their results are fetched by
+   * ticket (once)
+   */
+  auto manager = L4Re::MettEagle::getManager ("manager");
+
+  L4Re::chksys (manager->action_create ("async", "example-function"));
+
+  l4_umword_t first, second;
+  L4Re::chksys (manager->action_invoke_async ("async", "first", first));
+  L4Re::chksys (manager->action_invoke_async ("async", "second", second));
+  EXPECT_NE (first, second);
+
+  std::string answer;
+  EXPECT_NO_THROW (L4Re::chksys (manager->action_wait (second, answer)));
+  EXPECT_EQ (answer, std::string ("example function answer"));
+
+  /* the first invocation was either executed in the meantime or is executed
+   * by the wait */
+  char buffer[L4::Ipc::Msg::Mr_bytes];
+  L4::Ipc::Array<char> arr (sizeof (buffer), buffer);
+  long err;
+  while ((err = l4_error (manager->action_poll (first, arr))) == -L4_EAGAIN)
+    ;
+  EXPECT_EQ (err, L4_EOK);
+  EXPECT_EQ (std::string (arr.data), std::string ("example function answer"));
+
+  /* a ticket can only be used once */
+  EXPECT_THROW (L4Re::chksys (manager->action_wait (first, answer)),
+                L4::Runtime_error);
+}
+
+TEST (MettEagle, AsyncLimit)
+{
+  /**
+   * The number of outstanding invocations is limited, forgotten tickets
+   * don't count towards the limit
+   */
+  auto manager = L4Re::MettEagle::getManager ("manager");
+
+  L4Re::chksys (manager->action_create ("limit", "example-function"));
+
+  std::vector<l4_umword_t> tickets;
+  l4_umword_t ticket;
+  long err;
+  while ((err = l4_error (
+              manager->action_invoke_async ("limit", "argument", ticket)))
+             == L4_EOK
+         and tickets.size () < 1000)
+    tickets.push_back (ticket);
+  EXPECT_EQ (err, -L4_EBUSY);
+
+  /* a forgotten ticket frees its place and can't be used anymore */
+  EXPECT_NO_THROW (L4Re::chksys (manager->action_forget (tickets.back ())));
+  EXPECT_THROW (L4Re::chksys (manager->action_forget (tickets.back ())),
+                L4::Runtime_error);
+  std::string answer;
+  EXPECT_THROW (L4Re::chksys (manager->action_wait (tickets.back (), answer)),
+                L4::Runtime_error);
+  tickets.pop_back ();
+  EXPECT_NO_THROW (
+      L4Re::chksys (manager->action_invoke_async ("limit", "argument", ticket)));
+  tickets.push_back (ticket);
+
+  for (auto t : tickets)
+    EXPECT_NO_THROW (L4Re::chksys (manager->action_forget (t)));
+}
+
+TEST (MettEagle, BatchInvoke)
+{
+  /**
+   * All records of a batch are executed, failures only affect their own
+   * result record
+   */
+  auto manager = L4Re::MettEagle::getManager ("manager");
+
+  L4Re::chksys (manager->action_create ("batch", "example-function"));
+
+  using L4Re::MettEagle::Batch_request;
+  using L4Re::MettEagle::Batch_result;
+  constexpr unsigned count = 3;
+  auto size = l4_round_page (count
+                             * (sizeof (Batch_request) + sizeof (Batch_result)));
+  auto ds = L4Re::chkcap (L4Re::Util::make_unique_cap<L4Re::Dataspace> ());
+  L4Re::chksys (L4Re::Env::env ()->mem_alloc ()->alloc (size, ds.get ()));
+  L4Re::Rm::Unique_region<char *> region;
+  L4Re::chksys (L4Re::Env::env ()->rm ()->attach (
+      &region, size, L4Re::Rm::F::Search_addr | L4Re::Rm::F::RW,
+      L4::Ipc::make_cap_rw (ds.get ())));
+
+  auto requests = reinterpret_cast<Batch_request *> (region.get ());
+  auto results = reinterpret_cast<Batch_result *> (requests + count);
+  strcpy (requests[0].name, "batch");
+  strcpy (requests[1].name, "does-not-exist");
+  strcpy (requests[2].name, "batch");
+
+  EXPECT_NO_THROW (
+      L4Re::chksys (manager->action_invoke_batch (ds.get (), count)));
+
+  EXPECT_EQ (results[0].status, L4_EOK);
+  EXPECT_EQ (std::string (results[0].ret),
+             std::string ("example function answer"));
+  EXPECT_EQ (results[1].status, -L4_EINVAL);
+  EXPECT_EQ (results[2].status, L4_EOK);
+}
+
+TEST (MettEagle, MultiCoreClient)
+{
+  /**
+   * A client might get several cores, as long as at least one is available
+   */
+  auto manager = L4Re::MettEagle::getManager ("manager", 1, 2);
+
+  L4Re::chksys (manager->action_create ("multi-core", "example-function"));
+
+  std::string answer;
+  EXPECT_NO_THROW (L4Re::chksys (
+      manager->action_invoke ("multi-core", "some test argument", answer)));
+  EXPECT_EQ (answer, std::string ("example function answer"));
+
+  /* the minimum must not exceed the maximum */
+  EXPECT_THROW (L4Re::MettEagle::getManager ("manager", 2, 1),
+                L4::Runtime_error);
+}
+
+TEST (MettEagle, DataspaceInvoke)
+{
+  /**
+   * The payload is passed in dataspaces, thus it may exceed the utcb
+   */
+  auto manager = L4Re::MettEagle::getManager ("manager");
+
+  L4Re::chksys (manager->action_create ("copy", "example-copy"));
+
+  constexpr l4_size_t size = 4 * L4_PAGESIZE;
+  auto env = L4Re::Env::env ();
+  auto arg = L4Re::chkcap (L4Re::Util::make_unique_cap<L4Re::Dataspace> ());
+  auto result = L4Re::chkcap (L4Re::Util::make_unique_cap<L4Re::Dataspace> ());
+  L4Re::chksys (env->mem_alloc ()->alloc (size, arg.get ()));
+  L4Re::chksys (env->mem_alloc ()->alloc (size, result.get ()));
+
+  L4Re::Rm::Unique_region<char *> arg_region;
+  L4Re::Rm::Unique_region<char *> result_region;
+  L4Re::chksys (env->rm ()->attach (
+      &arg_region, size, L4Re::Rm::F::Search_addr | L4Re::Rm::F::RW,
+      L4::Ipc::make_cap_rw (arg.get ())));
+  L4Re::chksys (env->rm ()->attach (
+      &result_region, size, L4Re::Rm::F::Search_addr | L4Re::Rm::F::RW,
+      L4::Ipc::make_cap_rw (result.get ())));
+
+  for (l4_size_t i = 0; i < size; i++)
+    arg_region.get ()[i] = static_cast<char> (i % 251);
+
+  std::string answer;
+  l4_umword_t result_size = 0;
+  EXPECT_NO_THROW (L4Re::chksys (manager->action_invoke_ds (
+      "copy", "1234", arg.get (), size - 1,
+      L4::Ipc::make_cap_rw (result.get ()), answer, result_size)));
+  EXPECT_EQ (answer, std::string ("copied 1234"));
+  EXPECT_EQ (result_size, size - 1);
+  EXPECT_EQ (memcmp (arg_region.get (), result_region.get (), size - 1), 0);
+
+  /* a normal invocation (even with a numeric argument) has no dataspaces */
+  EXPECT_NO_THROW (
+      L4Re::chksys (manager->action_invoke ("copy", "1234", answer)));
+  EXPECT_EQ (answer, std::string ("no dataspaces"));
+
+  /* the argument must fit into its dataspace */
+  EXPECT_THROW (L4Re::chksys (manager->action_invoke_ds (
+                    "copy", "", arg.get (), size + 1,
+                    L4::Ipc::make_cap_rw (result.get ()), answer,
+                    result_size)),
+                L4::Runtime_error);
+}